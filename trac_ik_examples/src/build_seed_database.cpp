@@ -0,0 +1,82 @@
+/********************************************************************************
+Copyright (c) 2016, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+// Samples the joint space of a chain and writes a seed database that
+// TRAC_IK::setSeedDatabase(), or the kinematics plugin's seed_database
+// parameter, can warm start IK from.
+
+#include <trac_ik/trac_ik.hpp>
+#include <trac_ik/seed_database.hpp>
+#include <ros/ros.h>
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "build_seed_database");
+  ros::NodeHandle nh("~");
+
+  int num_samples;
+  std::string chain_start, chain_end, urdf_param, output;
+
+  nh.param("num_samples", num_samples, 1000000);
+  nh.param("chain_start", chain_start, std::string(""));
+  nh.param("chain_end", chain_end, std::string(""));
+  nh.param("urdf_param", urdf_param, std::string("/robot_description"));
+  nh.param("output", output, std::string(""));
+
+  if (chain_start == "" || chain_end == "" || output == "")
+  {
+    ROS_FATAL("Missing chain_start, chain_end or output parameter");
+    exit(-1);
+  }
+
+  if (num_samples < 1)
+    num_samples = 1;
+
+  TRAC_IK::TRAC_IK tracik_solver(chain_start, chain_end, urdf_param);
+
+  KDL::Chain chain;
+  KDL::JntArray ll, ul;
+
+  if (!tracik_solver.getKDLChain(chain) || !tracik_solver.getKDLLimits(ll, ul))
+  {
+    ROS_FATAL("There was no valid KDL chain found");
+    exit(-1);
+  }
+
+  ROS_INFO("Sampling %d configurations of %d joints", num_samples, chain.getNrOfJoints());
+
+  TRAC_IK::SeedDatabase db;
+  if (!db.build(chain, ll, ul, num_samples) || !db.save(output))
+    exit(-1);
+
+  ROS_INFO("Wrote %s", output.c_str());
+
+  return 0;
+}
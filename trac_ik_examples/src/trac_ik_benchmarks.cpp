@@ -0,0 +1,967 @@
+/********************************************************************************
+Copyright (c) 2016, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+// Standalone timing of TRAC-IK internals on synthetic chains.  Unlike
+// ik_tests, this needs no ROS master, parameter server or URDF.
+
+#include <trac_ik/trac_ik.hpp>
+#include <trac_ik/chain_cache.hpp>
+#include <trac_ik/chain_kinematics.hpp>
+#include <trac_ik/worker_pool.hpp>
+#include <trac_ik/deadline.hpp>
+#include <trac_ik/random.hpp>
+#include <trac_ik/seed_database.hpp>
+#include <trac_ik/solve_stats.hpp>
+#include <trac_ik/synthetic_chains.hpp>
+#include <boost/date_time.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+using namespace TRAC_IK::SyntheticChains;
+
+// The configurations and targets of every benchmark, drawn from a fixed
+// seed so that runs compare
+TRAC_IK::Random rng(1);
+
+double elapsed(const Clock::time_point& start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The latencies of one benchmark, and for the ones that solve IK, how
+// often and with how much work they succeeded.  Everything reported ends
+// up in results, from where it can be written out as JSON.
+struct Result
+{
+  Result(const std::string& _name, const std::string& _chain) :
+    name(_name), chain(_chain), solved(-1), iterations(-1) {}
+
+  std::string name;
+  std::string chain;
+  std::vector<double> latencies; // seconds per call
+  int solved;                    // -1 when nothing is solved
+  long iterations;               // over the solved calls, -1 when not counted
+};
+
+std::vector<Result> results;
+
+double percentile(std::vector<double> samples, double p)
+{
+  if (samples.empty())
+    return 0;
+  size_t k = std::min(samples.size() - 1, size_t(p * samples.size()));
+  std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+  return samples[k];
+}
+
+double mean(const std::vector<double>& samples)
+{
+  return samples.empty() ? 0 : std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+}
+
+void report(const Result& r)
+{
+  printf("%-20s %-8s p50 %9.2f us  p99 %9.2f us  mean %9.2f us", r.name.c_str(), r.chain.c_str(),
+         percentile(r.latencies, 0.5) * 1e6, percentile(r.latencies, 0.99) * 1e6, mean(r.latencies) * 1e6);
+  if (r.solved >= 0)
+    printf("  solved %6.2f%%", 100.0 * r.solved / r.latencies.size());
+  if (r.iterations >= 0 && r.solved > 0)
+    printf("  %.1f iterations/solve", double(r.iterations) / r.solved);
+  printf("\n");
+
+  results.push_back(r);
+}
+
+bool writeJson(const std::string& path, uint num_calls)
+{
+  FILE* out = fopen(path.c_str(), "w");
+  if (!out)
+  {
+    fprintf(stderr, "Cannot write %s\n", path.c_str());
+    return false;
+  }
+
+  fprintf(out, "{\n  \"num_calls\": %u,\n  \"threads\": %u,\n  \"results\": [\n", num_calls, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const Result& r = results[i];
+    fprintf(out, "    {\"name\": \"%s\", \"chain\": \"%s\", \"samples\": %u, \"p50_us\": %.4f, \"p99_us\": %.4f, \"mean_us\": %.4f",
+            r.name.c_str(), r.chain.c_str(), (uint)r.latencies.size(),
+            percentile(r.latencies, 0.5) * 1e6, percentile(r.latencies, 0.99) * 1e6, mean(r.latencies) * 1e6);
+    if (r.solved >= 0)
+      fprintf(out, ", \"solve_rate\": %.4f", double(r.solved) / r.latencies.size());
+    if (r.iterations >= 0 && r.solved > 0)
+      fprintf(out, ", \"iterations_per_solve\": %.2f", double(r.iterations) / r.solved);
+    fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+
+  fclose(out);
+  return true;
+}
+
+// Times num_samples batches of batch_size calls to op(i), with i counting
+// through all the calls, and records the latency per call of each batch.
+// Calls far shorter than a clock read still get a meaningful spread this
+// way.
+template <typename Op>
+Result timeBatches(const std::string& name, const std::string& chain, uint num_samples, uint batch_size, Op op)
+{
+  Result r(name, chain);
+  r.latencies.reserve(num_samples);
+
+  uint i = 0;
+  for (uint s = 0; s < num_samples; s++)
+  {
+    Clock::time_point start = Clock::now();
+    for (uint b = 0; b < batch_size; b++)
+      op(i++);
+    r.latencies.push_back(elapsed(start) / batch_size);
+  }
+
+  return r;
+}
+
+// Times every call to solve(i) on its own.  solve returns the solver's
+// return code and adds the iterations it took to the given count.
+template <typename Solve>
+Result timeSolves(const std::string& name, const std::string& chain, uint num_samples, bool count_iterations, Solve solve)
+{
+  Result r(name, chain);
+  r.latencies.reserve(num_samples);
+  r.solved = 0;
+  r.iterations = count_iterations ? 0 : -1;
+
+  for (uint i = 0; i < num_samples; i++)
+  {
+    long iterations = 0;
+    Clock::time_point start = Clock::now();
+    int rc = solve(i, iterations);
+    r.latencies.push_back(elapsed(start));
+    if (rc >= 0)
+    {
+      r.solved++;
+      if (count_iterations)
+        r.iterations += iterations;
+    }
+  }
+
+  return r;
+}
+
+// The kinematics and solver building blocks on one chain, from a single
+// forward kinematics pass up to a full TRAC_IK::CartToJnt, all on the same
+// random reachable poses
+void benchSuite(const std::string& name, const KDL::Chain& chain, const KDL::JntArray& ll, const KDL::JntArray& ul, uint num_samples, double timeout)
+{
+  uint n = chain.getNrOfJoints();
+  const uint batch = 100;
+
+  std::vector<KDL::JntArray> configs(num_samples, KDL::JntArray(n));
+  std::vector<std::vector<double> > xs(num_samples, std::vector<double>(n));
+  std::vector<KDL::Frame> poses(num_samples);
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  for (uint i = 0; i < num_samples; i++)
+  {
+    for (uint j = 0; j < n; j++)
+      xs[i][j] = configs[i](j) = rng.uniform(ll(j), ul(j));
+    fk_solver.JntToCart(configs[i], poses[i]);
+  }
+
+  KDL::ChainJntToJacSolver jac_solver(chain);
+  KDL::ChainKinematics kinematics(chain);
+  KDL::Frame pose;
+  KDL::Jacobian jac(n);
+
+  report(timeBatches("fk/kdl", name, num_samples, batch, [&](uint i)
+  {
+    fk_solver.JntToCart(configs[i % num_samples], pose);
+  }));
+
+  report(timeBatches("fk/fused", name, num_samples, batch, [&](uint i)
+  {
+    kinematics.JntToCart(configs[i % num_samples], pose);
+  }));
+
+  // Per configuration, pushed through the chain BATCH_WIDTH at a time
+  const uint width = KDL::ChainKinematics::BATCH_WIDTH;
+  const size_t num_blocks = std::max(num_samples / width, 1u);
+  std::vector<double> flat_configs(num_blocks * width * n);
+  for (size_t i = 0; i < num_blocks * width; i++)
+    std::copy(xs[i % num_samples].begin(), xs[i % num_samples].end(), flat_configs.begin() + i * n);
+  std::vector<KDL::Frame> block_poses(width);
+
+  Result fk_batch = timeBatches("fk/batch", name, num_samples, std::max(batch / width, 1u), [&](uint i)
+  {
+    kinematics.JntToCartBatch(&flat_configs[(i % num_blocks) * width * n], width, block_poses.data());
+  });
+  for (size_t i = 0; i < fk_batch.latencies.size(); i++)
+    fk_batch.latencies[i] /= width;
+  report(fk_batch);
+
+  report(timeBatches("jacobian/kdl", name, num_samples, batch, [&](uint i)
+  {
+    jac_solver.JntToJac(configs[i % num_samples], jac);
+  }));
+
+  report(timeBatches("fk+jacobian/fused", name, num_samples, batch, [&](uint i)
+  {
+    kinematics.JntToCartJac(configs[i % num_samples], pose, jac);
+  }));
+
+  // An expired deadline still lets the do-while loop of CartToJnt run
+  // exactly one iteration.  The seed and target come from different
+  // samples, so that the step is never skipped as already converged.
+  KDL::ChainIkSolverPos_TL tl_solver(chain, ll, ul, timeout, 1e-5, true, true);
+  KDL::JntArray result(n);
+  TRAC_IK::Deadline expired(0);
+
+  report(timeBatches("tl_step", name, num_samples, batch, [&](uint i)
+  {
+    tl_solver.CartToJnt(configs[i % num_samples], poses[(i + 1) % num_samples], result, expired);
+  }));
+
+  KDL::ChainIkSolverPos_TL lm_solver(chain, ll, ul, timeout, 1e-5, true, true);
+  lm_solver.setStepType(KDL::ChainIkSolverPos_TL::LevenbergMarquardt);
+
+  report(timeBatches("tl_step/lm", name, num_samples, batch, [&](uint i)
+  {
+    lm_solver.CartToJnt(configs[i % num_samples], poses[(i + 1) % num_samples], result, expired);
+  }));
+
+  // An unreachable target leaves the solver ready to evaluate errors
+  NLOPT_IK::NLOPT_IK nl_solver(chain, ll, ul, timeout, 1e-5, NLOPT_IK::SumSq);
+  KDL::JntArray nominal(n);
+  nl_solver.CartToJnt(nominal, KDL::Frame(KDL::Vector(10, 10, 10)), result, TRAC_IK::Deadline(0.0001));
+
+  std::vector<double> grad(n);
+  double error[1];
+
+  report(timeBatches("nlopt_objective", name, num_samples, batch, [&](uint i)
+  {
+    nl_solver.cartSumSquaredError(xs[i % num_samples], error);
+  }));
+
+  report(timeBatches("nlopt_objective+grad", name, num_samples, batch, [&](uint i)
+  {
+    nl_solver.cartSumSquaredError(xs[i % num_samples], error, grad.data());
+  }));
+
+  report(timeSolves("tl_solve", name, num_samples, true, [&](uint i, long & iterations)
+  {
+    int rc = tl_solver.CartToJnt(nominal, poses[i], result);
+    iterations += tl_solver.getIterations();
+    return rc;
+  }));
+
+  report(timeSolves("nlopt_solve", name, num_samples, true, [&](uint i, long & iterations)
+  {
+    int rc = nl_solver.CartToJnt(nominal, poses[i], result);
+    iterations += nl_solver.getEvaluations();
+    return rc;
+  }));
+
+  TRAC_IK::TRAC_IK tracik_solver(chain, ll, ul, timeout, 1e-5);
+
+  report(timeSolves("trac_ik_solve", name, num_samples, false, [&](uint i, long & iterations)
+  {
+    return tracik_solver.CartToJnt(nominal, poses[i], result);
+  }));
+}
+
+// What gathering SolveStats costs, per call and into a shared collector,
+// and what the stats say about each chain
+void benchStats(const std::string& name, const KDL::Chain& chain, const KDL::JntArray& ll, const KDL::JntArray& ul, uint num_samples, double timeout)
+{
+  uint n = chain.getNrOfJoints();
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  std::vector<KDL::Frame> poses(num_samples);
+  KDL::JntArray nominal(n), q(n), result(n);
+  for (uint i = 0; i < num_samples; i++)
+  {
+    for (uint j = 0; j < n; j++)
+      q(j) = rng.uniform(ll(j), ul(j));
+    fk_solver.JntToCart(q, poses[i]);
+  }
+
+  TRAC_IK::TRAC_IK tracik_solver(chain, ll, ul, timeout, 1e-5);
+
+  report(timeSolves("trac_ik_solve/stats_off", name, num_samples, false, [&](uint i, long & iterations)
+  {
+    return tracik_solver.CartToJnt(nominal, poses[i], result);
+  }));
+
+  TRAC_IK::SolveStats stats;
+  report(timeSolves("trac_ik_solve/stats", name, num_samples, true, [&](uint i, long & iterations)
+  {
+    int rc = tracik_solver.CartToJnt(nominal, poses[i], result, KDL::Twist::Zero(), &stats);
+    iterations += stats.kdl_iterations + stats.nlopt_evaluations;
+    return rc;
+  }));
+
+  std::shared_ptr<TRAC_IK::SolveStatsCollector> collector(new TRAC_IK::SolveStatsCollector());
+  tracik_solver.setStatsCollector(collector);
+
+  report(timeSolves("trac_ik_solve/collector", name, num_samples, false, [&](uint i, long & iterations)
+  {
+    return tracik_solver.CartToJnt(nominal, poses[i], result);
+  }));
+
+  TRAC_IK::SolveStatsCollector::Snapshot snap = collector->snapshot();
+  double calls = std::max<uint64_t>(snap.calls, 1);
+  printf("solve stats (%s): KDL won %.1f%%, NLopt won %.1f%%; per call %.1f KDL iterations, %.2f KDL restarts, "
+         "%.1f NLopt evaluations, %.2f NLopt restarts, %.3f duplicates, %.2f us merging\n", name.c_str(),
+         100 * snap.kdl_wins / calls, 100 * snap.nlopt_wins / calls, snap.kdl_iterations / calls, snap.kdl_restarts / calls,
+         snap.nlopt_evaluations / calls, snap.nlopt_restarts / calls, snap.duplicates_rejected / calls, snap.merge_time * 1e6 / calls);
+}
+
+// Latency, solve rate and CPU time of Speed solves with both racers always
+// started together, and with the adaptive head start
+void benchRacerSelection(const std::string& name, const KDL::Chain& chain, const KDL::JntArray& ll, const KDL::JntArray& ul, uint num_samples, double timeout)
+{
+  uint n = chain.getNrOfJoints();
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  std::vector<KDL::Frame> poses(num_samples);
+  KDL::JntArray nominal(n), q(n), result(n);
+  for (uint i = 0; i < num_samples; i++)
+  {
+    for (uint j = 0; j < n; j++)
+      q(j) = rng.uniform(ll(j), ul(j));
+    fk_solver.JntToCart(q, poses[i]);
+  }
+
+  struct
+  {
+    const char* name;
+    TRAC_IK::RacerSelection selection;
+  } selections[] = {{"race", TRAC_IK::AlwaysRace}, {"adaptive", TRAC_IK::Adaptive}};
+
+  for (uint s = 0; s < 2; s++)
+  {
+    TRAC_IK::TRAC_IK tracik_solver(chain, ll, ul, timeout, 1e-5);
+    tracik_solver.setRacerSelection(selections[s].selection);
+    std::shared_ptr<TRAC_IK::SolveStatsCollector> collector(new TRAC_IK::SolveStatsCollector());
+    tracik_solver.setStatsCollector(collector);
+
+    timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+    report(timeSolves(std::string("trac_ik_solve/") + selections[s].name, name, num_samples, false, [&](uint i, long & iterations)
+    {
+      return tracik_solver.CartToJnt(nominal, poses[i], result);
+    }));
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+
+    double cpu = (cpu_end.tv_sec - cpu_start.tv_sec) + (cpu_end.tv_nsec - cpu_start.tv_nsec) * 1e-9;
+    TRAC_IK::SolveStatsCollector::Snapshot snap = collector->snapshot();
+    printf("racers %s (%s): %.1f us CPU per solve, head start on %.1f%% of calls\n", selections[s].name, name.c_str(),
+           cpu * 1e6 / num_samples, 100.0 * snap.head_starts / std::max<uint64_t>(snap.calls, 1));
+  }
+}
+
+// The KDL solver alone with each kind of step, from the nominal seed to
+// random poses, and from nearby seeds to poses close to a singularity
+void benchSteps(const std::string& name, const KDL::Chain& chain, const KDL::JntArray& ll, const KDL::JntArray& ul, uint num_samples, double timeout)
+{
+  uint n = chain.getNrOfJoints();
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  KDL::ChainJntToJacSolver jac_solver(chain);
+  KDL::Jacobian jac(n);
+  std::vector<KDL::Frame> poses(num_samples), singular_poses;
+  std::vector<KDL::JntArray> singular_seeds;
+  KDL::JntArray nominal(n), q(n), result(n);
+  for (uint i = 0; i < num_samples; i++)
+  {
+    for (uint j = 0; j < n; j++)
+      q(j) = rng.uniform(ll(j), ul(j));
+    fk_solver.JntToCart(q, poses[i]);
+  }
+
+  // Singular means a Jacobian condition number above 100 here.  The seed
+  // is a small random step away, as when tracking a path through it.
+  for (uint tries = 0; tries < 1000 * num_samples && singular_poses.size() < num_samples; tries++)
+  {
+    for (uint j = 0; j < n; j++)
+      q(j) = rng.uniform(ll(j), ul(j));
+    jac_solver.JntToJac(q, jac);
+    Eigen::JacobiSVD<Eigen::MatrixXd> svd(jac.data);
+    if (svd.singularValues().minCoeff() > 0.01 * svd.singularValues().maxCoeff())
+      continue;
+
+    KDL::Frame pose;
+    fk_solver.JntToCart(q, pose);
+    singular_poses.push_back(pose);
+    for (uint j = 0; j < n; j++)
+      q(j) = std::min(ul(j), std::max(ll(j), q(j) + rng.uniform(-0.1, 0.1)));
+    singular_seeds.push_back(q);
+  }
+
+  struct
+  {
+    const char* name;
+    KDL::ChainIkSolverPos_TL::StepType type;
+    double damping;
+  } steps[] = {{"pinv", KDL::ChainIkSolverPos_TL::PseudoInverse, 0},
+               {"dls", KDL::ChainIkSolverPos_TL::PseudoInverse, 0.03},
+               {"lm", KDL::ChainIkSolverPos_TL::LevenbergMarquardt, 0},
+               {"eig", KDL::ChainIkSolverPos_TL::EigenPseudoInverse, 0}};
+
+  for (uint s = 0; s < sizeof(steps) / sizeof(steps[0]); s++)
+  {
+    KDL::ChainIkSolverPos_TL tl_solver(chain, ll, ul, timeout, 1e-5, true, true);
+    tl_solver.setStepType(steps[s].type);
+    tl_solver.setDamping(steps[s].damping);
+
+    report(timeSolves(std::string("tl_step/") + steps[s].name, name, num_samples, true, [&](uint i, long & iterations)
+    {
+      int rc = tl_solver.CartToJnt(nominal, poses[i], result);
+      iterations += tl_solver.getIterations();
+      return rc;
+    }));
+
+    if (!singular_poses.empty())
+      report(timeSolves(std::string("tl_singular/") + steps[s].name, name, singular_poses.size(), true, [&](uint i, long & iterations)
+      {
+        int rc = tl_solver.CartToJnt(singular_seeds[i], singular_poses[i], result);
+        iterations += tl_solver.getIterations();
+        return rc;
+      }));
+  }
+
+  // The default race, and the same with a Levenberg-Marquardt KDL racer
+  for (uint s = 0; s < 2; s++)
+  {
+    TRAC_IK::TRAC_IK tracik_solver(chain, ll, ul, timeout, 1e-5);
+    std::vector<TRAC_IK::RacerConfig> portfolio = TRAC_IK::TRAC_IK::makePortfolio(1, 1);
+    if (s == 1)
+      portfolio[0].step_type = KDL::ChainIkSolverPos_TL::LevenbergMarquardt;
+    tracik_solver.setPortfolio(portfolio);
+
+    report(timeSolves(std::string("trac_ik_step/") + (s == 0 ? "pinv" : "lm"), name, num_samples, false, [&](uint i, long & iterations)
+    {
+      return tracik_solver.CartToJnt(nominal, poses[i], result);
+    }));
+  }
+}
+
+// Latency, solve rate and CPU time of portfolios of growing size, and
+// which of their racers find the first solution
+void benchPortfolio(const std::string& name, const KDL::Chain& chain, const KDL::JntArray& ll, const KDL::JntArray& ul, uint num_samples, double timeout)
+{
+  uint n = chain.getNrOfJoints();
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  std::vector<KDL::Frame> poses(num_samples);
+  KDL::JntArray nominal(n), q(n), result(n);
+  for (uint i = 0; i < num_samples; i++)
+  {
+    for (uint j = 0; j < n; j++)
+      q(j) = rng.uniform(ll(j), ul(j));
+    fk_solver.JntToCart(q, poses[i]);
+  }
+
+  uint sizes[] = {1, 2, 4};
+
+  for (uint s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+  {
+    TRAC_IK::TRAC_IK tracik_solver(chain, ll, ul, timeout, 1e-5);
+    tracik_solver.setPortfolio(sizes[s], sizes[s]);
+    std::vector<uint> wins(2 * sizes[s], 0);
+    TRAC_IK::SolveStats stats;
+
+    char portfolio_name[32];
+    snprintf(portfolio_name, sizeof(portfolio_name), "trac_ik_solve/%u+%u", sizes[s], sizes[s]);
+
+    timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+    report(timeSolves(portfolio_name, name, num_samples, false, [&](uint i, long & iterations)
+    {
+      int rc = tracik_solver.CartToJnt(nominal, poses[i], result, KDL::Twist::Zero(), &stats);
+      if (stats.winning_racer >= 0)
+        wins[stats.winning_racer]++;
+      return rc;
+    }));
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+
+    double cpu = (cpu_end.tv_sec - cpu_start.tv_sec) + (cpu_end.tv_nsec - cpu_start.tv_nsec) * 1e-9;
+    printf("portfolio %u+%u (%s): %.1f us CPU per solve, first solutions by racer:", sizes[s], sizes[s], name.c_str(), cpu * 1e6 / num_samples);
+    for (uint r = 0; r < wins.size(); r++)
+      printf(" %u", wins[r]);
+    printf("\n");
+  }
+}
+
+// Solve rate and latency of TRAC_IK and of the KDL solver alone with each
+// restart strategy, on the same poses
+void benchRestarts(const std::string& name, const KDL::Chain& chain, const KDL::JntArray& ll, const KDL::JntArray& ul, uint num_samples, double timeout)
+{
+  uint n = chain.getNrOfJoints();
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+
+  std::vector<KDL::Frame> poses(num_samples);
+  KDL::JntArray nominal(n), q(n), result(n);
+  for (uint i = 0; i < num_samples; i++)
+  {
+    for (uint j = 0; j < n; j++)
+      q(j) = rng.uniform(ll(j), ul(j));
+    fk_solver.JntToCart(q, poses[i]);
+  }
+
+  struct
+  {
+    const char* name;
+    TRAC_IK::RestartStrategy strategy;
+  } strategies[] = {{"uniform", TRAC_IK::Uniform}, {"halton", TRAC_IK::Halton}, {"far", TRAC_IK::Far}};
+
+  char timeout_name[32];
+  snprintf(timeout_name, sizeof(timeout_name), "%gms", timeout * 1e3);
+
+  for (uint s = 0; s < sizeof(strategies) / sizeof(strategies[0]); s++)
+  {
+    KDL::ChainIkSolverPos_TL tl_solver(chain, ll, ul, timeout, 1e-5, true, true);
+    tl_solver.setRestartStrategy(strategies[s].strategy);
+
+    report(timeSolves(std::string("tl_") + timeout_name + "/" + strategies[s].name, name, num_samples, true, [&](uint i, long & iterations)
+    {
+      int rc = tl_solver.CartToJnt(nominal, poses[i], result);
+      iterations += tl_solver.getIterations();
+      return rc;
+    }));
+
+    TRAC_IK::TRAC_IK tracik_solver(chain, ll, ul, timeout, 1e-5);
+    tracik_solver.setRestartStrategy(strategies[s].strategy);
+
+    report(timeSolves(std::string("trac_ik_") + timeout_name + "/" + strategies[s].name, name, num_samples, false, [&](uint i, long & iterations)
+    {
+      return tracik_solver.CartToJnt(nominal, poses[i], result);
+    }));
+  }
+}
+
+// Building, saving and mapping a seed database, looking up neighbours,
+// and TRAC_IK from a cold nominal seed against warm starts from the
+// database, on the same poses
+void benchSeedDatabase(const std::string& name, const KDL::Chain& chain, const KDL::JntArray& ll, const KDL::JntArray& ul, uint num_samples, uint db_size, double timeout)
+{
+  uint n = chain.getNrOfJoints();
+
+  Clock::time_point start = Clock::now();
+  std::shared_ptr<TRAC_IK::SeedDatabase> built(new TRAC_IK::SeedDatabase());
+  built->build(chain, ll, ul, db_size);
+  double build_time = elapsed(start);
+
+  char path[] = "/tmp/trac_ik_seedsXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return;
+  close(fd);
+
+  start = Clock::now();
+  built->save(path);
+  double save_time = elapsed(start);
+
+  start = Clock::now();
+  std::shared_ptr<TRAC_IK::SeedDatabase> db(new TRAC_IK::SeedDatabase());
+  bool loaded = db->load(path);
+  double load_time = elapsed(start);
+  unlink(path);
+
+  printf("seed database (%s): %u entries, build %.1f ms, save %.1f ms, map %.1f us%s\n", name.c_str(), db_size,
+         build_time * 1e3, save_time * 1e3, load_time * 1e6, loaded && db->size() == db_size ? "" : " (load failed)");
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  std::vector<KDL::Frame> poses(num_samples);
+  KDL::JntArray nominal(n), q(n), result(n);
+  for (uint i = 0; i < num_samples; i++)
+  {
+    for (uint j = 0; j < n; j++)
+      q(j) = rng.uniform(ll(j), ul(j));
+    fk_solver.JntToCart(q, poses[i]);
+  }
+
+  std::vector<KDL::JntArray> seeds;
+  report(timeBatches("seed_db_nearest8", name, num_samples, 10, [&](uint i)
+  {
+    db->nearest(poses[i % num_samples], 8, seeds);
+  }));
+
+  char timeout_name[32];
+  snprintf(timeout_name, sizeof(timeout_name), "%gms", timeout * 1e3);
+
+  TRAC_IK::TRAC_IK tracik_solver(chain, ll, ul, timeout, 1e-5);
+
+  report(timeSolves(std::string("trac_ik_") + timeout_name + "/cold", name, num_samples, false, [&](uint i, long & iterations)
+  {
+    return tracik_solver.CartToJnt(nominal, poses[i], result);
+  }));
+
+  tracik_solver.setSeedDatabase(db);
+
+  report(timeSolves(std::string("trac_ik_") + timeout_name + "/seed_db", name, num_samples, false, [&](uint i, long & iterations)
+  {
+    return tracik_solver.CartToJnt(nominal, poses[i], result);
+  }));
+}
+
+// Writing and mapping back a cached chain
+void benchChainCache(const std::string& name, const KDL::Chain& chain, const KDL::JntArray& ll, const KDL::JntArray& ul, uint num_calls)
+{
+  char dir[] = "/tmp/trac_ik_chainsXXXXXX";
+  if (!mkdtemp(dir))
+    return;
+
+  TRAC_IK::ChainCache cache(dir);
+  const std::string urdf_xml = "<robot name=\"" + name + "\"/>";
+
+  Clock::time_point start = Clock::now();
+  cache.save(urdf_xml, "base", "tip", chain, ll, ul);
+  printf("chain cache (%s): save %.1f us\n", name.c_str(), elapsed(start) * 1e6);
+
+  KDL::Chain loaded;
+  KDL::JntArray loaded_ll, loaded_ul;
+  report(timeBatches("chain_cache_load", name, num_calls, 10, [&](uint i)
+  {
+    cache.load(urdf_xml, "base", "tip", loaded, loaded_ll, loaded_ul);
+  }));
+
+  unlink(cache.path(urdf_xml, "base", "tip").c_str());
+  rmdir(dir);
+}
+
+// Cost of handing the two racers to threads, without any solving
+void benchDispatch(uint num_calls)
+{
+  std::vector<std::function<void()> > racers(2, []() {});
+
+  Clock::time_point start = Clock::now();
+  for (uint i = 0; i < num_calls; i++)
+  {
+    std::thread task1(racers[0]);
+    std::thread task2(racers[1]);
+    task1.join();
+    task2.join();
+  }
+  double spawn = elapsed(start) / num_calls;
+
+  TRAC_IK::WorkerPool pool(1);
+  start = Clock::now();
+  for (uint i = 0; i < num_calls; i++)
+    pool.run(racers);
+  double pooled = elapsed(start) / num_calls;
+
+  printf("dispatch: spawn+join %.2f us/call, worker pool %.2f us/call\n", spawn * 1e6, pooled * 1e6);
+}
+
+// Time CartToJnt beyond the requested timeout for an unreachable pose, where
+// both racers are guaranteed to run until the deadline.
+void benchOverhead(uint num_calls)
+{
+  KDL::Chain chain;
+  KDL::JntArray ll, ul;
+  makeArm7(chain, ll, ul);
+
+  KDL::Frame unreachable(KDL::Vector(10, 10, 10));
+  KDL::JntArray nominal(chain.getNrOfJoints()), result;
+
+  double timeouts[] = {0.0001, 0.0005, 0.001, 0.005};
+
+  for (uint t = 0; t < sizeof(timeouts) / sizeof(timeouts[0]); t++)
+  {
+    TRAC_IK::TRAC_IK tracik_solver(chain, ll, ul, timeouts[t]);
+
+    Clock::time_point start = Clock::now();
+    for (uint i = 0; i < num_calls; i++)
+      tracik_solver.CartToJnt(nominal, unreachable, result);
+    double per_call = elapsed(start) / num_calls;
+
+    printf("timeout %.1f ms: %.1f us/call, %.1f us over the timeout\n",
+           timeouts[t] * 1e3, per_call * 1e6, (per_call - timeouts[t]) * 1e6);
+  }
+}
+
+// Cost of the time check every solver iteration makes: the wall clock
+// time with time zone conversion the solvers used to read, against the
+// steady clock Deadline
+void benchTimeCheck(uint num_checks)
+{
+  uint expired = 0;
+
+  boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::local_time();
+  Clock::time_point start = Clock::now();
+  for (uint i = 0; i < num_checks; i++)
+  {
+    boost::posix_time::time_duration diff = boost::posix_time::microsec_clock::local_time() - start_time;
+    if (1000.0 - diff.total_nanoseconds() / 1000000000.0 <= 0)
+      expired++;
+  }
+  double local_time = elapsed(start) / num_checks;
+
+  TRAC_IK::Deadline deadline(1000.0);
+
+  start = Clock::now();
+  for (uint i = 0; i < num_checks; i++)
+    if (deadline.expired())
+      expired++;
+  double steady = elapsed(start) / num_checks;
+
+  printf("time check per iteration: local_time %.1f ns, deadline %.1f ns%s\n",
+         local_time * 1e9, steady * 1e9, expired ? " (expired?)" : "");
+}
+
+// Restart draws per second from the C library rand() the solvers used to
+// share, against one TRAC_IK::Random per thread, on one and on all cores
+void benchRandom(uint num_draws)
+{
+  uint num_threads = std::max(2u, std::thread::hardware_concurrency());
+  std::vector<double> sums(num_threads);
+
+  for (uint threads = 1; threads <= num_threads; threads += num_threads - 1)
+  {
+    std::vector<std::thread> workers;
+    Clock::time_point start = Clock::now();
+    for (uint t = 0; t < threads; t++)
+      workers.push_back(std::thread([&, t]()
+      {
+        for (uint i = 0; i < num_draws; i++)
+          sums[t] += (double)rand() / RAND_MAX;
+      }));
+    for (uint t = 0; t < threads; t++)
+      workers[t].join();
+    double shared = elapsed(start);
+
+    workers.clear();
+    start = Clock::now();
+    for (uint t = 0; t < threads; t++)
+      workers.push_back(std::thread([&, t]()
+      {
+        TRAC_IK::Random thread_rng(TRAC_IK::Random::derive(1, t));
+        for (uint i = 0; i < num_draws; i++)
+          sums[t] += thread_rng.uniform(-1, 1);
+      }));
+    for (uint t = 0; t < threads; t++)
+      workers[t].join();
+    double own = elapsed(start);
+
+    printf("random draws on %u threads: rand() %.0f M/s, Random %.0f M/s\n", threads,
+           threads * num_draws / shared * 1e-6, threads * num_draws / own * 1e-6);
+  }
+}
+
+// Distinct solutions gathered per second in Distance mode, where both
+// racers keep collecting solutions until the timeout
+void benchDistance(uint num_samples, double timeout)
+{
+  KDL::Chain chain;
+  KDL::JntArray ll, ul;
+  makeArm7(chain, ll, ul);
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  TRAC_IK::TRAC_IK tracik_solver(chain, ll, ul, timeout, 1e-5, TRAC_IK::Distance);
+
+  KDL::JntArray nominal(chain.getNrOfJoints()), q(chain.getNrOfJoints()), result;
+  KDL::Frame end_effector_pose;
+
+  double total_time = 0;
+  uint total_solutions = 0;
+
+  for (uint i = 0; i < num_samples; i++)
+  {
+    for (uint j = 0; j < ll.data.size(); j++)
+      q(j) = rng.uniform(ll(j), ul(j));
+    fk_solver.JntToCart(q, end_effector_pose);
+
+    Clock::time_point start = Clock::now();
+    int rc = tracik_solver.CartToJnt(nominal, end_effector_pose, result);
+    total_time += elapsed(start);
+    if (rc > 0)
+      total_solutions += rc;
+  }
+
+  printf("distance (timeout %.1f ms): %.1f solutions per call, %.0f solutions/s\n",
+         timeout * 1e3, double(total_solutions) / num_samples, total_solutions / total_time);
+}
+
+// Throughput of many poses solved one by one versus in one batch
+void benchBatch(uint num_samples, double timeout)
+{
+  KDL::Chain chain;
+  KDL::JntArray ll, ul;
+  makeArm7(chain, ll, ul);
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  TRAC_IK::TRAC_IK tracik_solver(chain, ll, ul, timeout);
+
+  std::vector<KDL::JntArray> seeds(1, KDL::JntArray(chain.getNrOfJoints()));
+  std::vector<KDL::Frame> poses(num_samples);
+  std::vector<KDL::JntArray> results;
+  std::vector<int> rcs;
+  KDL::JntArray q(chain.getNrOfJoints());
+
+  for (uint i = 0; i < num_samples; i++)
+  {
+    for (uint j = 0; j < ll.data.size(); j++)
+      q(j) = rng.uniform(ll(j), ul(j));
+    fk_solver.JntToCart(q, poses[i]);
+  }
+
+  uint success = 0;
+  Clock::time_point start = Clock::now();
+  for (uint i = 0; i < num_samples; i++)
+    if (tracik_solver.CartToJnt(seeds[0], poses[i], q) >= 0)
+      success++;
+  double sequential = elapsed(start);
+
+  printf("batch (timeout %.1f ms): one by one %.0f poses/s (%u solved)", timeout * 1e3, num_samples / sequential, success);
+
+  start = Clock::now();
+  int solved = tracik_solver.CartToJntBatch(seeds, poses, results, rcs);
+  double batched = elapsed(start);
+
+  printf(", batched %.0f poses/s (%d solved) on %u threads\n", num_samples / batched, solved, std::max(2u, std::thread::hardware_concurrency()));
+}
+
+// Many DualQuat NLOPT_IK solvers running at once, one per thread, each
+// with its own targets.  NLOPT_IK.ConcurrentDualQuatInstances checks the
+// solutions; this only measures the throughput.
+void benchConcurrent(uint num_samples)
+{
+  KDL::Chain chain;
+  KDL::JntArray ll, ul;
+  makeArm7(chain, ll, ul);
+  uint n = chain.getNrOfJoints();
+
+  uint num_threads = std::max(4u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  std::atomic<uint> solved(0);
+
+  std::vector<std::vector<KDL::JntArray> > configs(num_threads, std::vector<KDL::JntArray>(num_samples, KDL::JntArray(n)));
+  for (uint t = 0; t < num_threads; t++)
+    for (uint i = 0; i < num_samples; i++)
+      for (uint j = 0; j < n; j++)
+        configs[t][i](j) = rng.uniform(ll(j), ul(j));
+
+  Clock::time_point start = Clock::now();
+  for (uint t = 0; t < num_threads; t++)
+    threads.push_back(std::thread([&, t]()
+    {
+      KDL::ChainFkSolverPos_recursive fk_solver(chain);
+      NLOPT_IK::NLOPT_IK solver(chain, ll, ul, 0.005, 1e-5, NLOPT_IK::DualQuat);
+      KDL::JntArray seed(n), result;
+      KDL::Frame target;
+
+      for (uint i = 0; i < num_samples; i++)
+      {
+        fk_solver.JntToCart(configs[t][i], target);
+        for (uint j = 0; j < n; j++)
+          seed(j) = std::min(ul(j), std::max(ll(j), configs[t][i](j) + 0.1));
+
+        if (solver.CartToJnt(seed, target, result) >= 0)
+          solved++;
+      }
+    }));
+
+  for (uint t = 0; t < num_threads; t++)
+    threads[t].join();
+
+  printf("concurrent DualQuat: %u threads, %.0f solves/s, %u of %u solved\n",
+         num_threads, num_threads * num_samples / elapsed(start), solved.load(), num_threads * num_samples);
+}
+
+int main(int argc, char** argv)
+{
+  // trac_ik_benchmarks [num_calls] [--json results.json]
+  uint num_calls = 1000;
+  std::string json_path;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg(argv[i]);
+    if (arg == "--json" && i + 1 < argc)
+      json_path = argv[++i];
+    else
+      num_calls = std::max(1, atoi(argv[i]));
+  }
+
+  struct
+  {
+    const char* name;
+    void (*make)(KDL::Chain&, KDL::JntArray&, KDL::JntArray&);
+  } chains[] = {{"6-DOF", makeArm6}, {"7-DOF", makeArm7}, {"12-DOF", makeArm12}, {"gantry", makeGantry}};
+
+  for (uint c = 0; c < sizeof(chains) / sizeof(chains[0]); c++)
+  {
+    KDL::Chain chain;
+    KDL::JntArray ll, ul;
+    chains[c].make(chain, ll, ul);
+    benchSuite(chains[c].name, chain, ll, ul, num_calls, 0.005);
+    benchStats(chains[c].name, chain, ll, ul, num_calls, 0.005);
+    benchRacerSelection(chains[c].name, chain, ll, ul, num_calls, 0.005);
+    benchPortfolio(chains[c].name, chain, ll, ul, num_calls, 0.005);
+    benchSteps(chains[c].name, chain, ll, ul, num_calls, 0.005);
+  }
+
+  for (uint c = 1; c < 3; c++)
+  {
+    KDL::Chain chain;
+    KDL::JntArray ll, ul;
+    chains[c].make(chain, ll, ul);
+    benchRestarts(chains[c].name, chain, ll, ul, num_calls, 0.001);
+    benchRestarts(chains[c].name, chain, ll, ul, num_calls, 0.005);
+    benchSeedDatabase(chains[c].name, chain, ll, ul, num_calls, 100000, 0.001);
+    benchChainCache(chains[c].name, chain, ll, ul, num_calls);
+  }
+
+  benchDispatch(num_calls);
+  benchOverhead(num_calls);
+  benchTimeCheck(num_calls * 1000);
+  benchRandom(num_calls * 1000);
+  benchDistance(num_calls / 10 + 1, 0.005);
+  benchDistance(num_calls / 100 + 1, 0.05);
+  benchBatch(num_calls, 0.001);
+  benchConcurrent(num_calls / 10 + 1);
+
+  if (!json_path.empty() && !writeJson(json_path, num_calls))
+    return 1;
+
+  return 0;
+}
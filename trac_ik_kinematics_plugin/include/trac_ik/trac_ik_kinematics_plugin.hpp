@@ -33,6 +33,11 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <moveit/kinematics_base/kinematics_base.h>
 #include <kdl/chain.hpp>
+#include <trac_ik/trac_ik.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace trac_ik_kinematics_plugin
 {
@@ -46,13 +51,26 @@ class TRAC_IKKinematicsPlugin : public kinematics::KinematicsBase
   bool active_; // Internal variable that indicates whether solvers are configured and ready
 
   KDL::Chain chain;
+  // Number of chain segments up to and including each link, 0 for the base
+  std::unordered_map<std::string, int> segment_index_;
   bool position_ik_;
+  bool adaptive_racers_;
+  int kdl_racers_, nlopt_racers_;
 
   KDL::JntArray joint_min, joint_max;
 
   std::string solve_type;
   std::string free_angle;
 
+  // Optional, shared by every pooled solver
+  std::shared_ptr<const TRAC_IK::SeedDatabase> seed_db_;
+
+  // Solvers are built on first use and reused across queries, one list per
+  // solve type.  A query takes a solver out of the pool for its duration,
+  // so MoveIt's concurrent callers never share an instance.
+  mutable std::mutex solver_mtx_;
+  mutable std::map<TRAC_IK::SolveType, std::vector<std::unique_ptr<TRAC_IK::TRAC_IK> > > solver_pool_;
+
 public:
   const std::vector<std::string>& getJointNames() const
   {
@@ -67,7 +85,7 @@ public:
   /** @class
    *  @brief Interface for an TRAC-IK kinematics plugin
    */
-  TRAC_IKKinematicsPlugin(): active_(false), position_ik_(false) {}
+  TRAC_IKKinematicsPlugin(): active_(false), position_ik_(false), adaptive_racers_(false), kdl_racers_(1), nlopt_racers_(1) {}
 
   ~TRAC_IKKinematicsPlugin()
   {
@@ -181,6 +199,18 @@ public:
                      const std::vector<double> &joint_angles,
                      std::vector<geometry_msgs::Pose> &poses) const;
 
+  /**
+   * @brief Batch version of the above, for many joint states at once
+   *
+   * @param link_names A set of links for which FK needs to be computed
+   * @param joint_angles The states for which FK is being computed
+   * @param poses For every state, the resultant set of poses (in the frame returned by getBaseFrame())
+   * @return True if every pose could be computed, false otherwise
+   */
+  bool getPositionFK(const std::vector<std::string> &link_names,
+                     const std::vector<std::vector<double> > &joint_angles,
+                     std::vector<std::vector<geometry_msgs::Pose> > &poses) const;
+
 
   bool initialize(const std::string &robot_description,
                   const std::string& group_name,
@@ -192,6 +222,19 @@ private:
 
   int getKDLSegmentIndex(const std::string &name) const;
 
+  // Looks up the segment index of every link, -1 for unknown links.
+  // Returns the largest index.
+  int getKDLSegmentIndices(const std::vector<std::string> &link_names, std::vector<int> &segments) const;
+
+  // Poses of the given segment indices, in one pass over the chain up to
+  // last_segment.  frames is scratch space.
+  void computeLinkPoses(const std::vector<int> &segments, int last_segment,
+                        const std::vector<double> &joint_angles, std::vector<KDL::Frame> &frames,
+                        std::vector<geometry_msgs::Pose> &poses) const;
+
+  std::unique_ptr<TRAC_IK::TRAC_IK> acquireSolver(TRAC_IK::SolveType type, double epsilon) const;
+  void releaseSolver(TRAC_IK::SolveType type, std::unique_ptr<TRAC_IK::TRAC_IK> solver) const;
+
 }; // end class
 }
 
@@ -30,12 +30,11 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 
 
 #include <ros/ros.h>
-#include <urdf/model.h>
 #include <tf_conversions/tf_kdl.h>
 #include <algorithm>
-#include <kdl/tree.hpp>
-#include <kdl_parser/kdl_parser.hpp>
 #include <trac_ik/trac_ik.hpp>
+#include <trac_ik/chain_builder.hpp>
+#include <trac_ik/chain_cache.hpp>
 #include <trac_ik/trac_ik_kinematics_plugin.hpp>
 #include <limits>
 
@@ -49,10 +48,14 @@ bool TRAC_IKKinematicsPlugin::initialize(const std::string &robot_description,
     double search_discretization)
 {
   setValues(robot_description, group_name, base_name, tip_name, search_discretization);
+
+  {
+    std::lock_guard<std::mutex> lock(solver_mtx_);
+    solver_pool_.clear();
+  }
   
   ros::NodeHandle node_handle("~");
   
-  urdf::Model robot_model;
   std::string xml_string;
   
   std::string urdf_xml, full_urdf_xml;
@@ -67,79 +70,29 @@ bool TRAC_IKKinematicsPlugin::initialize(const std::string &robot_description,
   }
   
   node_handle.param(full_urdf_xml, xml_string, std::string());
-  robot_model.initString(xml_string);
 
-  ROS_DEBUG_STREAM_NAMED("trac_ik", "Reading joints and links from URDF");
-  
-  KDL::Tree tree;
-  
-  if (!kdl_parser::treeFromUrdfModel(robot_model, tree))
-  {
-    ROS_FATAL("Failed to extract kdl tree from xml robot description");
-    return false;
-  }
-  
-  if (!tree.getChain(base_name, tip_name, chain))
-  {
-    ROS_FATAL("Couldn't find chain %s to %s", base_name.c_str(), tip_name.c_str());
+  std::string chain_cache_dir;
+  lookupParam(group_name + "/chain_cache_dir", chain_cache_dir, TRAC_IK::ChainCache::defaultDirectory());
+  TRAC_IK::ChainCache cache(chain_cache_dir);
+
+  TRAC_IK::ChainBuilder builder;
+  if (!builder.build(xml_string, base_name, tip_name, &cache))
     return false;
-  }
-  
+
+  chain = builder.getChain();
+  joint_min = builder.getLowerLimits();
+  joint_max = builder.getUpperLimits();
+  joint_names_ = builder.getJointNames();
+  link_names_ = builder.getLinkNames();
   num_joints_ = chain.getNrOfJoints();
-  
-  std::vector<KDL::Segment> chain_segs = chain.segments;
-  
-  urdf::JointConstSharedPtr joint;
-  
-  std::vector<double> l_bounds, u_bounds;
-  
-  joint_min.resize(num_joints_);
-  joint_max.resize(num_joints_);
-  
-  uint joint_num = 0;
-  for (unsigned int i = 0; i < chain_segs.size(); ++i)
-  {
-    
-    link_names_.push_back(chain_segs[i].getName());
-    joint = robot_model.getJoint(chain_segs[i].getJoint().getName());
-    if (joint->type != urdf::Joint::UNKNOWN && joint->type != urdf::Joint::FIXED)
-    {
-      joint_num++;
-      assert(joint_num <= num_joints_);
-      float lower, upper;
-      int hasLimits;
-      joint_names_.push_back(joint->name);
-      if (joint->type != urdf::Joint::CONTINUOUS)
-      {
-        if (joint->safety)
-        {
-          lower = std::max(joint->limits->lower, joint->safety->soft_lower_limit);
-          upper = std::min(joint->limits->upper, joint->safety->soft_upper_limit);
-        }
-        else
-        {
-          lower = joint->limits->lower;
-          upper = joint->limits->upper;
-        }
-        hasLimits = 1;
-      }
-      else
-      {
-        hasLimits = 0;
-      }
-      if (hasLimits)
-      {
-        joint_min(joint_num - 1) = lower;
-        joint_max(joint_num - 1) = upper;
-      }
-      else
-      {
-        joint_min(joint_num - 1) = std::numeric_limits<float>::lowest();
-        joint_max(joint_num - 1) = std::numeric_limits<float>::max();
-      }
-      ROS_INFO_STREAM("IK Using joint " << chain_segs[i].getName() << " " << joint_min(joint_num - 1) << " " << joint_max(joint_num - 1));
-    }
-  }
+
+  for (uint i = 0; i < num_joints_; ++i)
+    ROS_INFO_STREAM("IK Using joint " << joint_names_[i] << " " << joint_min(i) << " " << joint_max(i));
+
+  segment_index_.clear();
+  segment_index_[base_name] = 0;
+  for (unsigned int i = 0; i < chain.getNrOfSegments(); ++i)
+    segment_index_[chain.getSegment(i).getName()] = i + 1;
 
   ROS_INFO_NAMED("trac-ik plugin", "Looking in common namespaces for param name: %s", (group_name + "/position_only_ik").c_str());
   lookupParam(group_name + "/position_only_ik", position_ik_, false);
@@ -151,6 +104,37 @@ bool TRAC_IKKinematicsPlugin::initialize(const std::string &robot_description,
   ROS_INFO_NAMED("trac-ik plugin", "Looking in common namespaces for param name: %s", (group_name + "/free_angle").c_str());
   lookupParam(group_name + "/free_angle", free_angle, std::string(""));
   ROS_INFO_NAMED("trac_ik plugin", "Using free angle(s) %s", free_angle.c_str());
+
+  ROS_INFO_NAMED("trac-ik plugin", "Looking in common namespaces for param name: %s", (group_name + "/adaptive_racers").c_str());
+  lookupParam(group_name + "/adaptive_racers", adaptive_racers_, false);
+
+  ROS_INFO_NAMED("trac-ik plugin", "Looking in common namespaces for param names: %s and %s", (group_name + "/kdl_racers").c_str(), (group_name + "/nlopt_racers").c_str());
+  lookupParam(group_name + "/kdl_racers", kdl_racers_, 1);
+  lookupParam(group_name + "/nlopt_racers", nlopt_racers_, 1);
+  if (kdl_racers_ < 0 || nlopt_racers_ < 0 || kdl_racers_ + nlopt_racers_ == 0)
+  {
+    ROS_WARN_NAMED("trac_ik plugin", "Invalid racer counts %d and %d; using one of each", kdl_racers_, nlopt_racers_);
+    kdl_racers_ = nlopt_racers_ = 1;
+  }
+  ROS_INFO_NAMED("trac_ik plugin", "Racing %d KDL and %d NLOPT solvers", kdl_racers_, nlopt_racers_);
+
+  std::string seed_database;
+  ROS_INFO_NAMED("trac-ik plugin", "Looking in common namespaces for param name: %s", (group_name + "/seed_database").c_str());
+  lookupParam(group_name + "/seed_database", seed_database, std::string(""));
+  seed_db_.reset();
+  if (!seed_database.empty())
+  {
+    std::shared_ptr<TRAC_IK::SeedDatabase> db(new TRAC_IK::SeedDatabase());
+    if (!db->load(seed_database))
+      ROS_WARN_NAMED("trac_ik plugin", "Could not load seed database %s; solving without it", seed_database.c_str());
+    else if (!db->matches(chain))
+      ROS_WARN_NAMED("trac_ik plugin", "Seed database %s was built for a different chain; solving without it", seed_database.c_str());
+    else
+    {
+      ROS_INFO_NAMED("trac_ik plugin", "Using seed database %s with %d entries", seed_database.c_str(), (int)db->size());
+      seed_db_ = db;
+    }
+  }
   
   
   active_ = true;
@@ -158,18 +142,84 @@ bool TRAC_IKKinematicsPlugin::initialize(const std::string &robot_description,
 }
 
 
-int TRAC_IKKinematicsPlugin::getKDLSegmentIndex(const std::string &name) const
+std::unique_ptr<TRAC_IK::TRAC_IK> TRAC_IKKinematicsPlugin::acquireSolver(TRAC_IK::SolveType type, double epsilon) const
 {
-  int i = 0;
-  while (i < (int)chain.getNrOfSegments())
   {
-    if (chain.getSegment(i).getName() == name)
+    std::lock_guard<std::mutex> lock(solver_mtx_);
+    std::vector<std::unique_ptr<TRAC_IK::TRAC_IK> >& solvers = solver_pool_[type];
+    if (!solvers.empty())
     {
-      return i + 1;
+      std::unique_ptr<TRAC_IK::TRAC_IK> solver = std::move(solvers.back());
+      solvers.pop_back();
+      return solver;
     }
-    i++;
   }
-  return -1;
+
+  // Only reached until there is one solver per concurrent caller
+  std::unique_ptr<TRAC_IK::TRAC_IK> solver(new TRAC_IK::TRAC_IK(chain, joint_min, joint_max, 0.005, epsilon, type));
+  if (seed_db_)
+    solver->setSeedDatabase(seed_db_);
+  if (kdl_racers_ != 1 || nlopt_racers_ != 1)
+    solver->setPortfolio(kdl_racers_, nlopt_racers_);
+  if (adaptive_racers_)
+    solver->setRacerSelection(TRAC_IK::Adaptive);
+  return solver;
+}
+
+
+void TRAC_IKKinematicsPlugin::releaseSolver(TRAC_IK::SolveType type, std::unique_ptr<TRAC_IK::TRAC_IK> solver) const
+{
+  std::lock_guard<std::mutex> lock(solver_mtx_);
+  solver_pool_[type].push_back(std::move(solver));
+}
+
+
+int TRAC_IKKinematicsPlugin::getKDLSegmentIndex(const std::string &name) const
+{
+  std::unordered_map<std::string, int>::const_iterator it = segment_index_.find(name);
+  return it == segment_index_.end() ? -1 : it->second;
+}
+
+
+int TRAC_IKKinematicsPlugin::getKDLSegmentIndices(const std::vector<std::string> &link_names, std::vector<int> &segments) const
+{
+  segments.resize(link_names.size());
+  int last_segment = 0;
+  for (unsigned int i = 0; i < link_names.size(); i++)
+  {
+    segments[i] = getKDLSegmentIndex(link_names[i]);
+    ROS_DEBUG_NAMED("trac_ik", "End effector index: %d", segments[i]);
+    if (segments[i] < 0)
+      ROS_ERROR_NAMED("trac_ik", "Could not compute FK for %s", link_names[i].c_str());
+    last_segment = std::max(last_segment, segments[i]);
+  }
+  return last_segment;
+}
+
+
+void TRAC_IKKinematicsPlugin::computeLinkPoses(const std::vector<int> &segments, int last_segment,
+    const std::vector<double> &joint_angles, std::vector<KDL::Frame> &frames,
+    std::vector<geometry_msgs::Pose> &poses) const
+{
+  // frames[s] is the frame at the end of the first s segments, as
+  // ChainFkSolverPos_recursive would compute it for segmentNr s
+  frames.resize(last_segment + 1);
+  frames[0] = KDL::Frame::Identity();
+
+  unsigned int j = 0;
+  for (int s = 0; s < last_segment; s++)
+  {
+    const KDL::Segment& segment = chain.getSegment(s);
+    if (segment.getJoint().getType() != KDL::Joint::None)
+      frames[s + 1] = frames[s] * segment.pose(joint_angles[j++]);
+    else
+      frames[s + 1] = frames[s] * segment.pose(0.0);
+  }
+
+  poses.resize(segments.size());
+  for (unsigned int i = 0; i < segments.size(); i++)
+    if (segments[i] >= 0)
+      tf::poseKDLToMsg(frames[segments[i]], poses[i]);
 }
 
 
@@ -189,34 +239,44 @@ bool TRAC_IKKinematicsPlugin::getPositionFK(const std::vector<std::string> &link
     return false;
   }
 
-  KDL::Frame p_out;
-  geometry_msgs::PoseStamped pose;
-  tf::Stamped<tf::Pose> tf_pose;
+  std::vector<int> segments;
+  int last_segment = getKDLSegmentIndices(link_names, segments);
 
-  KDL::JntArray jnt_pos_in(num_joints_);
-  for (unsigned int i = 0; i < num_joints_; i++)
-  {
-    jnt_pos_in(i) = joint_angles[i];
-  }
+  std::vector<KDL::Frame> frames;
+  computeLinkPoses(segments, last_segment, joint_angles, frames, poses);
+
+  return std::find(segments.begin(), segments.end(), -1) == segments.end();
+}
 
-  KDL::ChainFkSolverPos_recursive fk_solver(chain);
 
-  bool valid = true;
-  for (unsigned int i = 0; i < poses.size(); i++)
+bool TRAC_IKKinematicsPlugin::getPositionFK(const std::vector<std::string> &link_names,
+    const std::vector<std::vector<double> > &joint_angles,
+    std::vector<std::vector<geometry_msgs::Pose> > &poses) const
+{
+  if (!active_)
   {
-    ROS_DEBUG_NAMED("trac_ik", "End effector index: %d", getKDLSegmentIndex(link_names[i]));
-    if (fk_solver.JntToCart(jnt_pos_in, p_out, getKDLSegmentIndex(link_names[i])) >= 0)
-    {
-      tf::poseKDLToMsg(p_out, poses[i]);
-    }
-    else
+    ROS_ERROR_NAMED("trac_ik", "kinematics not active");
+    return false;
+  }
+  poses.resize(joint_angles.size());
+  for (unsigned int k = 0; k < joint_angles.size(); k++)
+  {
+    if (joint_angles[k].size() != num_joints_)
     {
-      ROS_ERROR_NAMED("trac_ik", "Could not compute FK for %s", link_names[i].c_str());
-      valid = false;
+      ROS_ERROR_NAMED("trac_ik", "Joint angles vector must have size: %d", num_joints_);
+      return false;
     }
   }
 
-  return valid;
+  // The links are looked up once for all the states
+  std::vector<int> segments;
+  int last_segment = getKDLSegmentIndices(link_names, segments);
+
+  std::vector<KDL::Frame> frames;
+  for (unsigned int k = 0; k < joint_angles.size(); k++)
+    computeLinkPoses(segments, last_segment, joint_angles[k], frames, poses[k]);
+
+  return std::find(segments.begin(), segments.end(), -1) == segments.end();
 }
 
 
@@ -341,6 +401,13 @@ bool TRAC_IKKinematicsPlugin::searchPositionIK(const geometry_msgs::Pose &ik_pos
     return false;
   }
 
+  if (!consistency_limits.empty() && consistency_limits.size() != num_joints_)
+  {
+    ROS_ERROR_STREAM_NAMED("trac_ik", "Consistency limits must be empty or have size " << num_joints_ << " instead of size " << consistency_limits.size());
+    error_code.val = error_code.NO_IK_SOLUTION;
+    return false;
+  }
+
   KDL::Frame frame;
   tf::poseMsgToKDL(ik_pose, frame);
 
@@ -400,9 +467,27 @@ bool TRAC_IKKinematicsPlugin::searchPositionIK(const geometry_msgs::Pose &ik_pos
     solvetype = TRAC_IK::Speed;
   }
 
-  TRAC_IK::TRAC_IK ik_solver(chain, joint_min, joint_max, timeout, epsilon, solvetype);
+  std::unique_ptr<TRAC_IK::TRAC_IK> ik_solver = acquireSolver(solvetype, epsilon);
+  ik_solver->setMaxtime(timeout);
+
+  int rc;
+  if (consistency_limits.empty())
+    rc = ik_solver->CartToJnt(in, frame, out, bounds);
+  else
+  {
+    // Only search within consistency_limits of the seed.  Where that box
+    // misses a joint's limits altogether, CartToJnt fails and so does
+    // the query.
+    KDL::JntArray lower(num_joints_), upper(num_joints_);
+    for (uint z = 0; z < num_joints_; z++)
+    {
+      lower(z) = ik_seed_state[z] - consistency_limits[z];
+      upper(z) = ik_seed_state[z] + consistency_limits[z];
+    }
+    rc = ik_solver->CartToJnt(in, frame, lower, upper, out, bounds);
+  }
 
-  int rc = ik_solver.CartToJnt(in, frame, out, bounds);
+  releaseSolver(solvetype, std::move(ik_solver));
 
 
   solution.resize(num_joints_);
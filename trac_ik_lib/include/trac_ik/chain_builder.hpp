@@ -0,0 +1,109 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef TRAC_IK_CHAIN_BUILDER_HPP
+#define TRAC_IK_CHAIN_BUILDER_HPP
+
+#include <kdl/chain.hpp>
+#include <kdl/jntarray.hpp>
+#include <string>
+#include <vector>
+
+namespace TRAC_IK
+{
+
+class ChainCache;
+
+/* @brief The KDL chain between two links of a URDF, together with the
+   joint limits, joint names and link names the solvers and the wrappers
+   need.
+
+   Parsed URDFs and their KDL trees are kept for reuse by every builder in
+   the process, so building chains for many solvers, or many base and tip
+   links, parses each URDF once.  Given a ChainCache, a chain saved by an
+   earlier process skips parsing altogether.  Builders on different
+   threads may run concurrently.
+*/
+class ChainBuilder
+{
+public:
+  // Returns false, with the reason logged, if the URDF cannot be parsed
+  // or holds no chain from base_link to tip_link.  The chain and limits
+  // are then left empty.
+  bool build(const std::string& urdf_xml, const std::string& base_link, const std::string& tip_link,
+             const ChainCache* cache = NULL);
+
+  inline const KDL::Chain& getChain() const
+  {
+    return chain;
+  }
+
+  // Continuous joints get the float range as limits, like TRAC_IK expects
+  inline const KDL::JntArray& getLowerLimits() const
+  {
+    return q_min;
+  }
+
+  inline const KDL::JntArray& getUpperLimits() const
+  {
+    return q_max;
+  }
+
+  // One per movable joint, in chain order
+  inline const std::vector<std::string>& getJointNames() const
+  {
+    return joint_names;
+  }
+
+  // One per segment, fixed ones included, in chain order
+  inline const std::vector<std::string>& getLinkNames() const
+  {
+    return link_names;
+  }
+
+  // Forgets the URDFs parsed so far
+  static void clearParsedUrdfs();
+
+  // Number of most recently used URDFs kept parsed
+  static const unsigned int MAX_PARSED_URDFS = 4;
+
+private:
+  KDL::Chain chain;
+  KDL::JntArray q_min, q_max;
+  std::vector<std::string> joint_names;
+  std::vector<std::string> link_names;
+
+  void clear();
+  void nameJointsAndLinks();
+};
+
+}
+
+#endif
@@ -0,0 +1,77 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef TRAC_IK_CHAIN_CACHE_HPP
+#define TRAC_IK_CHAIN_CACHE_HPP
+
+#include <kdl/chain.hpp>
+#include <kdl/jntarray.hpp>
+#include <stdint.h>
+#include <string>
+
+namespace TRAC_IK
+{
+
+/* @brief Binary files holding a KDL chain and its joint limits, so that a
+   process starting up on a URDF it has seen before can skip parsing it
+   and building the KDL tree.
+
+   Each file is named after a hash of the URDF text and the base and tip
+   links, so an edited URDF simply misses the cache.  Files are written
+   once, atomically, and memory-mapped when read; any number of processes
+   can share one directory.
+*/
+class ChainCache
+{
+public:
+  // An empty directory disables the cache: load() always misses and
+  // save() does nothing
+  explicit ChainCache(const std::string& directory);
+
+  bool load(const std::string& urdf_xml, const std::string& base_link, const std::string& tip_link,
+            KDL::Chain& chain, KDL::JntArray& q_min, KDL::JntArray& q_max) const;
+
+  bool save(const std::string& urdf_xml, const std::string& base_link, const std::string& tip_link,
+            const KDL::Chain& chain, const KDL::JntArray& q_min, const KDL::JntArray& q_max) const;
+
+  std::string path(const std::string& urdf_xml, const std::string& base_link, const std::string& tip_link) const;
+
+  // $ROS_HOME/trac_ik_chains, or ~/.ros/trac_ik_chains
+  static std::string defaultDirectory();
+
+private:
+  std::string directory;
+
+  static uint64_t key(const std::string& urdf_xml, const std::string& base_link, const std::string& tip_link);
+};
+
+}
+
+#endif
@@ -0,0 +1,121 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef KDLCHAINKINEMATICS_HPP
+#define KDLCHAINKINEMATICS_HPP
+
+#include <kdl/chain.hpp>
+#include <kdl/jacobian.hpp>
+#include <kdl/jntarray.hpp>
+#include <kdl/chainfksolverpos_recursive.hpp>
+#include <kdl/chainjnttojacsolver.hpp>
+#include <memory>
+#include <vector>
+
+namespace KDL
+{
+
+/* @brief Forward kinematics and Jacobian of a chain computed together in a
+   single pass from base to tip.  The joint axes, scales and offsets are
+   extracted once at construction, and every fixed segment is folded into
+   the constant transform between two joints, so the traversal only visits
+   the movable joints.  The Jacobian follows the conventions of
+   ChainJntToJacSolver (base frame, reference point at the tip).
+
+   Apart from the fallback below, the methods keep no state and may be
+   called concurrently.  Should a joint not match the model this class
+   assumes for KDL joints, it falls back to the KDL solvers.
+*/
+class ChainKinematics
+{
+public:
+  explicit ChainKinematics(const Chain& chain);
+
+  inline unsigned int getNrOfJoints() const
+  {
+    return joints.size();
+  }
+
+  int JntToCart(const JntArray& q_in, Frame& p_out) const;
+  int JntToCartJac(const JntArray& q_in, Frame& p_out, Jacobian& jac) const;
+
+  // Same as above for callers that keep the joints in a plain array
+  void JntToCart(const double* q_in, Frame& p_out) const;
+  void JntToCartJac(const double* q_in, Frame& p_out, Jacobian& jac) const;
+
+  // Forward kinematics of count configurations, stored one after the
+  // other in q_in (count * getNrOfJoints() values), into p_out[0..count).
+  // Configurations are pushed through the chain BATCH_WIDTH at a time, in
+  // structure of arrays form, so that the compiler can vectorize the
+  // frame products across configurations.
+  void JntToCartBatch(const double* q_in, size_t count, Frame* p_out) const;
+  int JntToCartBatch(const std::vector<JntArray>& q_in, std::vector<Frame>& p_out) const;
+
+  static const int BATCH_WIDTH = 4;
+
+private:
+  struct JointData
+  {
+    // Fixed transform from the moved frame of the previous joint (or the
+    // base) to the frame this joint moves in
+    Frame pre;
+    // Unit axis the joint rotates about or translates along, in that frame
+    Vector axis;
+    double scale;
+    bool rotational;
+  };
+
+  std::vector<JointData> joints;
+
+  // The traversals, for N joints known at compile time on the common 6
+  // and 7 joint chains, so that the loops unroll and the Jacobian is
+  // written through a fixed size map, or for N = Eigen::Dynamic
+  template<int N>
+  void fixedJntToCart(const double* q_in, Frame& p_out) const;
+  template<int N>
+  void fixedJntToCartJac(const double* q_in, Frame& p_out, Jacobian& jac) const;
+
+  // Up to BATCH_WIDTH configurations at once, q_in[l] being the joints of
+  // the l-th one
+  void blockJntToCart(const double* const* q_in, int count, Frame* p_out) const;
+
+  // Fixed transform from the moved frame of the last joint to the tip
+  Frame post;
+
+  // Only used for chains whose joints did not match the model above
+  const Chain chain;
+  std::unique_ptr<ChainFkSolverPos_recursive> fallback_fk;
+  std::unique_ptr<ChainJntToJacSolver> fallback_jac;
+  mutable JntArray fallback_q;
+};
+
+}
+
+#endif
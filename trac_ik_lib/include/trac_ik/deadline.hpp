@@ -0,0 +1,78 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef TRAC_IK_DEADLINE_HPP
+#define TRAC_IK_DEADLINE_HPP
+
+#include <chrono>
+
+namespace TRAC_IK
+{
+
+/* @brief The point in time at which an IK call has to stop, on the
+   monotonic steady clock.  TRAC_IK builds one per CartToJnt() call and
+   hands it to both solvers, so all three stop at the same moment.  A
+   Deadline is never modified after construction and can be read from any
+   number of threads.
+*/
+class Deadline
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  // Expires the given number of seconds from now
+  explicit Deadline(double seconds = 0) :
+    end(Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds))) {}
+
+  explicit Deadline(const Clock::time_point& _end) : end(_end) {}
+
+  inline bool expired() const
+  {
+    return Clock::now() >= end;
+  }
+
+  // Seconds left, negative once expired
+  inline double remaining() const
+  {
+    return std::chrono::duration<double>(end - Clock::now()).count();
+  }
+
+  inline const Clock::time_point& time() const
+  {
+    return end;
+  }
+
+private:
+  Clock::time_point end;
+};
+
+}
+
+#endif
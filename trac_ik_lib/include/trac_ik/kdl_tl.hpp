@@ -32,8 +32,12 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef KDLCHAINIKSOLVERPOS_TL_HPP
 #define KDLCHAINIKSOLVERPOS_TL_HPP
 
-#include <kdl/chainfksolverpos_recursive.hpp>
-#include <kdl/chainiksolvervel_pinv.hpp>
+#include <trac_ik/chain_kinematics.hpp>
+#include <trac_ik/deadline.hpp>
+#include <trac_ik/restart_sampler.hpp>
+#include <Eigen/Cholesky>
+#include <Eigen/SVD>
+#include <atomic>
 
 namespace TRAC_IK
 {
@@ -50,35 +54,138 @@ class ChainIkSolverPos_TL
   friend class TRAC_IK::TRAC_IK;
 
 public:
+  // How each iteration turns the Cartesian error into a joint step
+  enum StepType
+  {
+    // Through the SVD pseudo-inverse of the Jacobian, see setDamping()
+    PseudoInverse,
+    // Levenberg-Marquardt: damped least squares solved by a 6x6 Cholesky
+    // factorization, damped by the current error plus a bias that grows
+    // whenever a step makes the error worse and shrinks when it helps
+    LevenbergMarquardt,
+    // The pseudo-inverse from a 6x6 eigendecomposition of J J^T instead
+    // of the SVD, about twice as fast for 6 joints or more (fewer joints
+    // take the SVD anyway).  It drops the same singular values below
+    // 1e-5, as eigenvalues below 1e-10, but J J^T has the squared
+    // condition number of J: its small eigenvalues are only accurate to
+    // about 1e-16 times the largest, so near singularities it can drop
+    // directions the SVD keeps and its steps differ.  Opt-in for that
+    // reason.
+    EigenPseudoInverse
+  };
+
   ChainIkSolverPos_TL(const Chain& chain, const JntArray& q_min, const JntArray& q_max, double maxtime = 0.005, double eps = 1e-3, bool random_restart = false, bool try_jl_wrap = false);
 
   ~ChainIkSolverPos_TL();
 
   int CartToJnt(const KDL::JntArray& q_init, const KDL::Frame& p_in, KDL::JntArray& q_out, const KDL::Twist bounds = KDL::Twist::Zero());
 
+  // Same as above, but runs until the given deadline instead of maxtime
+  int CartToJnt(const KDL::JntArray& q_init, const KDL::Frame& p_in, KDL::JntArray& q_out, const TRAC_IK::Deadline& deadline, const KDL::Twist bounds = KDL::Twist::Zero());
+
   inline void setMaxtime(double t)
   {
     maxtime = t;
   }
 
+  // Number of iterations the last CartToJnt call ran
+  inline int getIterations() const
+  {
+    return iterations;
+  }
+
+  // Restarts the random restart sequence from the given seed
+  inline void setSeed(uint64_t seed)
+  {
+    restarts.setSeed(seed);
+  }
+
+  inline void setRestartStrategy(TRAC_IK::RestartStrategy strategy)
+  {
+    restarts.setStrategy(strategy);
+  }
+
+  // Damps each pseudo-inverse step as sigma / (sigma^2 + lambda^2).  The
+  // default of 0 keeps the plain pseudo-inverse.
+  inline void setDamping(double lambda)
+  {
+    damping = lambda;
+  }
+
+  // PseudoInverse by default
+  inline void setStepType(StepType type)
+  {
+    step_type = type;
+  }
+
+  // Until clearSearchLimits(), keeps every joint within lower..upper as
+  // well as within its limits, both when clamping the steps and when
+  // drawing restarts.  Continuous joints are then bounded too.  Returns
+  // false if some joint's range is empty, in which case CartToJnt returns
+  // -3 until the limits change.
+  bool setSearchLimits(const JntArray& lower, const JntArray& upper);
+  void clearSearchLimits();
+
 private:
   const Chain chain;
+  // The limits of the current search, and the joint limits given at
+  // construction
   JntArray q_min;
   JntArray q_max;
+  JntArray joint_min;
+  JntArray joint_max;
+  // Whether q_min..q_max is empty for some joint
+  bool empty_search;
 
   KDL::Twist bounds;
 
-  KDL::ChainIkSolverVel_pinv vik_solver;
-  KDL::ChainFkSolverPos_recursive fksolver;
+  KDL::ChainKinematics kinematics;
+
+  // Working buffers, sized once here so that the iterations in CartToJnt
+  // never go to the heap
+  KDL::Jacobian jac;
+  // Chains of other than 6 or 7 joints take their SVD pseudo-inverse
+  // steps here, on a dynamic matrix; handing it jac.data directly would
+  // convert into a temporary on every call
+  Eigen::MatrixXd svd_input;
+  Eigen::JacobiSVD<Eigen::MatrixXd> svd;
   JntArray delta_q;
+  JntArray q_curr;
   double maxtime;
+  int iterations;
 
   double eps;
+  double damping;
+  StepType step_type;
+
+  // Levenberg-Marquardt state: the last accepted configuration, with its
+  // Jacobian and twist error, and the current damping bias
+  JntArray lm_q;
+  Eigen::Matrix<double, 6, Eigen::Dynamic> lm_jac;
+  Eigen::Matrix<double, 6, 1> lm_dx;
+  double lm_error;
+  double lm_bias;
+  Eigen::LLT<Eigen::Matrix<double, 6, 6> > lm_llt;
+
+  void resetLM();
+
+  // Sets delta_q to the step for the twist error dx at jac, where lambda2
+  // is the Levenberg-Marquardt damping.  The common 6 and 7 joint chains
+  // take fixedStep(), where the Jacobian and every product have sizes
+  // known at compile time and live on the stack; other chains work on
+  // jac.data directly.
+  void step(const Eigen::Matrix<double, 6, 1>& dx, double lambda2);
+
+  template<int N>
+  void fixedStep(const Eigen::Matrix<double, 6, 1>& dx, double lambda2);
 
   bool rr;
   bool wrap;
 
+  // Likewise for the current search, where a bounded continuous joint
+  // counts as RotJoint, and as constructed
   std::vector<KDL::BasicJointType> types;
+  std::vector<KDL::BasicJointType> joint_types;
 
   inline void abort()
   {
@@ -90,16 +197,14 @@ private:
     aborted = false;
   }
 
-  bool aborted;
+  std::atomic<bool> aborted;
 
   Frame f;
   Twist delta_twist;
 
-  inline static double fRand(double min, double max)
-  {
-    double f = (double)rand() / RAND_MAX;
-    return min + f * (max - min);
-  }
+  TRAC_IK::RestartSampler restarts;
+  JntArray restart_lower;
+  JntArray restart_upper;
 
 
 };
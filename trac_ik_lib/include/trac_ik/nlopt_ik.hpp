@@ -32,8 +32,13 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #define NLOPT_IK_HPP
 
 #include <trac_ik/kdl_tl.hpp>
+#include <trac_ik/chain_kinematics.hpp>
+#include <trac_ik/restart_sampler.hpp>
 #include <nlopt.hpp>
+#include <atomic>
+#include <memory>
 
+struct dual_quaternion;
 
 namespace NLOPT_IK
 {
@@ -47,20 +52,47 @@ class NLOPT_IK
 public:
   NLOPT_IK(const KDL::Chain& chain, const KDL::JntArray& q_min, const KDL::JntArray& q_max, double maxtime = 0.005, double eps = 1e-3, OptType type = SumSq);
 
-  ~NLOPT_IK() {};
+  ~NLOPT_IK();
   int CartToJnt(const KDL::JntArray& q_init, const KDL::Frame& p_in, KDL::JntArray& q_out, const KDL::Twist bounds = KDL::Twist::Zero(), const KDL::JntArray& q_desired = KDL::JntArray());
 
+  // Same as above, but runs until the given deadline instead of maxtime
+  int CartToJnt(const KDL::JntArray& q_init, const KDL::Frame& p_in, KDL::JntArray& q_out, const TRAC_IK::Deadline& deadline, const KDL::Twist bounds = KDL::Twist::Zero(), const KDL::JntArray& q_desired = KDL::JntArray());
+
   double minJoints(const std::vector<double>& x, std::vector<double>& grad);
   //  void cartFourPointError(const std::vector<double>& x, double error[]);
-  void cartSumSquaredError(const std::vector<double>& x, double error[]);
-  void cartDQError(const std::vector<double>& x, double error[]);
-  void cartL2NormError(const std::vector<double>& x, double error[]);
+  // When grad is given, it is filled with the gradient of the error,
+  // computed from the chain Jacobian in the same pass as the pose.
+  void cartSumSquaredError(const std::vector<double>& x, double error[], double grad[] = NULL);
+  void cartDQError(const std::vector<double>& x, double error[], double grad[] = NULL);
+  void cartL2NormError(const std::vector<double>& x, double error[], double grad[] = NULL);
 
   inline void setMaxtime(double t)
   {
     maxtime = t;
   }
 
+  // Number of Cartesian error evaluations (each one forward kinematics
+  // pass) the last CartToJnt call made, over all of its restarts
+  inline int getEvaluations() const
+  {
+    return iter_counter;
+  }
+
+  // Restarts the random restart sequence from the given seed
+  inline void setSeed(uint64_t seed)
+  {
+    restarts.setSeed(seed);
+  }
+
+  inline void setRestartStrategy(TRAC_IK::RestartStrategy strategy)
+  {
+    restarts.setStrategy(strategy);
+  }
+
+  // As ChainIkSolverPos_TL::setSearchLimits()
+  bool setSearchLimits(const KDL::JntArray& lower, const KDL::JntArray& upper);
+  void clearSearchLimits();
+
 private:
 
   inline void abort()
@@ -74,14 +106,21 @@ private:
   }
 
 
+  // The limits of the current search, and the joint limits given at
+  // construction
   std::vector<double> lb;
   std::vector<double> ub;
+  std::vector<double> joint_lb;
+  std::vector<double> joint_ub;
+  // Whether lb..ub is empty for some joint
+  bool empty_search;
 
   const KDL::Chain chain;
   std::vector<double> des;
 
 
-  KDL::ChainFkSolverPos_recursive fksolver;
+  KDL::ChainKinematics kinematics;
+  KDL::Jacobian jac;
 
   double maxtime;
   double eps;
@@ -89,6 +128,7 @@ private:
   OptType TYPE;
 
   KDL::Frame targetPose;
+  std::unique_ptr<dual_quaternion> targetDQ;
   KDL::Frame z_up ;
   KDL::Frame x_out;
   KDL::Frame y_out;
@@ -97,22 +137,35 @@ private:
   KDL::Frame y_target;
 
   std::vector<KDL::BasicJointType> types;
+  std::vector<KDL::BasicJointType> joint_types;
 
   nlopt::opt opt;
 
   KDL::Frame currentPose;
 
+  // Error twist of currentPose before and after applying the bounds
+  KDL::Twist currentTwist;
+  KDL::Twist currentError;
+
+  // All of these use currentPose and jac as left by the error functions
+  // grad = J^T * pose_grad, with the sizes known at compile time for the
+  // common 6 and 7 joint chains
+  void jacobianTransposeProduct(const Eigen::Matrix<double, 6, 1>& pose_grad, double grad[]) const;
+  // The joint gradient of a function of currentTwist, from its gradient
+  // with respect to currentTwist
+  void twistGradient(const Eigen::Matrix<double, 6, 1>& twist_grad, double grad[]) const;
+  void sumSquaredGradient(double grad[]);
+  void dqGradient(double grad[]);
+  void l2NormGradient(double grad[]);
+  double dqError(const KDL::Frame& pose) const;
+
   std::vector<double> best_x;
   int progress;
-  bool aborted;
+  std::atomic<bool> aborted;
 
   KDL::Twist bounds;
 
-  inline static double fRand(double min, double max)
-  {
-    double f = (double)rand() / RAND_MAX;
-    return min + f * (max - min);
-  }
+  TRAC_IK::RestartSampler restarts;
 
 
 };
@@ -0,0 +1,102 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef TRAC_IK_RACER_SCHEDULER_HPP
+#define TRAC_IK_RACER_SCHEDULER_HPP
+
+#include <trac_ik/solve_stats.hpp>
+#include <vector>
+
+namespace TRAC_IK
+{
+
+/* AlwaysRace: both racers start together on every call, as TRAC_IK always
+   did.
+   Adaptive: once one racer is seen to win most races on this chain, it
+   starts alone, and the other only joins if no solution has turned up by
+   the time the favourite usually has one.
+*/
+enum RacerSelection { AlwaysRace, Adaptive };
+
+/* @brief Learns, for one TRAC_IK instance, which racer wins and how
+   quickly, and plans each call from that: start both at once, or hold one
+   racer back for a while.  A held back racer is not dispatched before
+   then, so calls the favourite solves alone cost one core instead of two.
+
+   Every PROBE_INTERVAL-th call, and every call until MIN_PROBES races
+   have been seen, still starts both racers together.  Only those races
+   count towards the win shares, so the favourite's head start cannot
+   feed on itself, and a change in the mix of targets is noticed.
+*/
+class RacerScheduler
+{
+public:
+  RacerScheduler();
+
+  void reset();
+
+  // Which racer to hold back for the coming call, and for how many
+  // seconds; NoRacer to start both at once
+  void plan(double maxtime, SolveStats::Racer& held_back, double& delay);
+
+  // What happened in the call planned last
+  void update(SolveStats::Racer winner, double time_to_first_solution, double maxtime);
+
+  // The share of recent full races the KDL racer won
+  inline double kdlWinShare() const
+  {
+    return kdl_share;
+  }
+
+private:
+  static const unsigned int PROBE_INTERVAL = 16;
+  static const unsigned int MIN_PROBES = 16;
+  // Past times to solution kept per racer
+  static const unsigned int WINDOW = 64;
+
+  unsigned long calls;
+  unsigned int probes;
+  double kdl_share;
+
+  SolveStats::Racer planned_hold;
+
+  // Each racer's recent times to its first solution, as rings; a call it
+  // did not solve counts as taking the whole timeout
+  std::vector<double> times[2];
+  unsigned int times_next[2];
+  std::vector<double> scratch;
+
+  void addTime(SolveStats::Racer racer, double time);
+  double quantile(SolveStats::Racer racer, double q);
+};
+
+}
+
+#endif
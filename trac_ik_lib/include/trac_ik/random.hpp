@@ -0,0 +1,117 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef TRAC_IK_RANDOM_HPP
+#define TRAC_IK_RANDOM_HPP
+
+#include <stdint.h>
+
+namespace TRAC_IK
+{
+
+/* @brief The random number generator behind the random restarts of the
+   solvers: xoshiro256** (Blackman and Vigna, "Scrambled Linear
+   Pseudorandom Number Generators", 2018), seeded through splitmix64.
+
+   Every solver owns one, unlike the C library rand() it replaces, which
+   has hidden global state, takes a lock in glibc and interleaves the
+   draws of all threads.  A solver's restarts therefore depend only on its
+   own seed, and solvers racing on different threads never contend.  An
+   instance is not thread-safe by itself.
+*/
+class Random
+{
+public:
+  static const uint64_t DEFAULT_SEED = 0x5eed5eed5eed5eedULL;
+
+  explicit Random(uint64_t seed = DEFAULT_SEED)
+  {
+    setSeed(seed);
+  }
+
+  void setSeed(uint64_t seed)
+  {
+    for (int i = 0; i < 4; i++)
+      state[i] = splitmix64(seed);
+  }
+
+  inline uint64_t next()
+  {
+    const uint64_t result = rotl(state[1] * 5, 7) * 9;
+    const uint64_t t = state[1] << 17;
+
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+
+    state[2] ^= t;
+    state[3] = rotl(state[3], 45);
+
+    return result;
+  }
+
+  // Uniform in [min, max)
+  inline double uniform(double min, double max)
+  {
+    // The top 53 bits fill the mantissa of a double in [0, 1)
+    double f = (next() >> 11) * (1.0 / 9007199254740992.0);
+    return min + f * (max - min);
+  }
+
+  // A seed for stream number stream of the generators derived from seed,
+  // so that e.g. the two racers of one TRAC_IK draw unrelated restarts
+  static uint64_t derive(uint64_t seed, uint64_t stream)
+  {
+    uint64_t x = seed ^ (0xd1342543de82ef95ULL * (stream + 1));
+    return splitmix64(x);
+  }
+
+private:
+  uint64_t state[4];
+
+  static inline uint64_t rotl(uint64_t x, int k)
+  {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  // Advances x and returns the next output of the splitmix64 sequence
+  static inline uint64_t splitmix64(uint64_t& x)
+  {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+};
+
+}
+
+#endif
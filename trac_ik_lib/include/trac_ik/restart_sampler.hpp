@@ -0,0 +1,129 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef TRAC_IK_RESTART_SAMPLER_HPP
+#define TRAC_IK_RESTART_SAMPLER_HPP
+
+#include <trac_ik/random.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace TRAC_IK
+{
+
+/* Uniform: independent uniform draws, as the solvers always did.
+   Halton: a Halton sequence with randomly scrambled digits, which covers
+   the joint box evenly instead of clustering.
+   Far: the best of several uniform candidates, keeping the one farthest
+   from every seed already tried in the current call.
+*/
+enum RestartStrategy { Uniform, Halton, Far };
+
+/* @brief Where the solvers draw their random restart seeds from.  Each
+   solver owns one, used from whichever thread runs that solver.  The
+   seeds tried since the last reset() (for Far) and the Halton sequence
+   position are kept here, so the restarts made inside a solver and those
+   TRAC_IK makes between its calls see each other.
+*/
+class RestartSampler
+{
+public:
+  explicit RestartSampler(unsigned int num_joints, RestartStrategy strategy = Uniform);
+
+  inline void setSeed(uint64_t seed)
+  {
+    rng.setSeed(seed);
+  }
+
+  inline void setStrategy(RestartStrategy _strategy)
+  {
+    strategy = _strategy;
+  }
+
+  inline RestartStrategy getStrategy() const
+  {
+    return strategy;
+  }
+
+  // Forgets the seeds tried so far and starts a newly scrambled Halton
+  // sequence; called at the start of every IK call
+  void reset();
+
+  // Records a seed that did not come from sample(), such as the caller's
+  // initial guess
+  void add(const double* x);
+
+  // Makes sample() hand out x before drawing anything itself, in the
+  // order queued, until the next reset()
+  void queue(const double* x);
+
+  // Fills x with a restart seed within lower..upper for every joint, and
+  // records it
+  void sample(const double* lower, const double* upper, double* x);
+
+  // Seeds handed out by sample() since the last reset()
+  inline uint64_t getSampleCount() const
+  {
+    return samples;
+  }
+
+private:
+  unsigned int n;
+  RestartStrategy strategy;
+  Random rng;
+
+  // One prime base per joint, and a random permutation of the digits of
+  // each base, all concatenated
+  std::vector<unsigned int> bases;
+  std::vector<unsigned int> permutations;
+  std::vector<unsigned int> offsets;
+  uint64_t index;
+
+  // The most recent seeds, n values each, as a ring of HISTORY entries
+  static const unsigned int HISTORY = 64;
+  static const unsigned int CANDIDATES = 8;
+  std::vector<double> history;
+  unsigned int history_size;
+  unsigned int history_next;
+  std::vector<double> candidate;
+
+  std::vector<double> queued;
+  size_t queued_next;
+
+  uint64_t samples;
+
+  double distanceToHistory(const double* x, const double* lower, const double* upper) const;
+
+  static double radicalInverse(uint64_t i, unsigned int base, const unsigned int* permutation);
+};
+
+}
+
+#endif
@@ -0,0 +1,152 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef TRAC_IK_SEED_DATABASE_HPP
+#define TRAC_IK_SEED_DATABASE_HPP
+
+#include <kdl/chain.hpp>
+#include <kdl/frames.hpp>
+#include <kdl/jntarray.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace TRAC_IK
+{
+
+/* @brief Joint configurations sampled over the limits of a chain, indexed
+   by the end effector pose they reach, so that IK can start from stored
+   configurations that land near the target instead of from a cold seed.
+
+   Poses are compared on a 7D key: the position, plus the unit quaternion
+   of the rotation scaled by rotationScale() (meters per unit of
+   quaternion distance).  The entries are stored as an implicit balanced
+   k-d tree in one flat block, laid out exactly as in the file written by
+   save().  load() memory-maps that file and searches it in place, so
+   opening even a large database costs next to nothing.
+
+   A database is never modified after build() or load(), so any number of
+   solvers and threads can share one.
+*/
+class SeedDatabase
+{
+public:
+  SeedDatabase();
+
+  ~SeedDatabase();
+
+  // Samples num_samples configurations uniformly within the limits
+  // (continuous joints within -pi..pi) and indexes their poses.  A
+  // rotation_scale of 0 picks the chain's reach.
+  bool build(const KDL::Chain& chain, const KDL::JntArray& q_min, const KDL::JntArray& q_max,
+             unsigned int num_samples, uint64_t seed = 1, double rotation_scale = 0);
+
+  bool save(const std::string& path) const;
+
+  // Maps a file written by save().  Returns false, leaving the database
+  // empty, if the file is missing or malformed.
+  bool load(const std::string& path);
+
+  // Fills seeds with the (up to) k stored configurations whose poses are
+  // nearest to pose, nearest first
+  void nearest(const KDL::Frame& pose, unsigned int k, std::vector<KDL::JntArray>& seeds) const;
+
+  inline size_t size() const
+  {
+    return header ? header->num_entries : 0;
+  }
+
+  inline unsigned int getNrOfJoints() const
+  {
+    return header ? header->num_joints : 0;
+  }
+
+  inline double rotationScale() const
+  {
+    return header ? header->rotation_scale : 0;
+  }
+
+  // True if the database was built for a chain with this geometry
+  bool matches(const KDL::Chain& chain) const;
+
+  // Identifies the kinematic structure of a chain (joint types and
+  // segment frames), independent of its joint limits
+  static uint64_t chainHash(const KDL::Chain& chain);
+
+private:
+  static const unsigned int KEY_SIZE = 7;
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_joints;
+    uint64_t num_entries;
+    uint64_t chain_hash;
+    double rotation_scale;
+  };
+
+  // Either points into buffer, for a database built here, or into the
+  // mapped file
+  const Header* header;
+  const double* keys;       // num_entries * KEY_SIZE
+  const double* joints;     // num_entries * num_joints
+  const uint8_t* split_dims; // num_entries, the split axis of each node
+
+  std::vector<char> buffer;
+  void* mapping;
+  size_t mapping_size;
+
+  void clear();
+  bool attach(const char* data, size_t size);
+  static size_t layoutSize(uint64_t num_entries, uint32_t num_joints);
+
+  void makeKey(const KDL::Frame& pose, double scale, double key[]) const;
+
+  struct Neighbor
+  {
+    double dist;
+    size_t index;
+    bool operator<(const Neighbor& other) const
+    {
+      return dist < other.dist;
+    }
+  };
+
+  void search(size_t lo, size_t hi, const double key[], unsigned int k, std::vector<Neighbor>& heap,
+              double offsets[], double bound) const;
+
+  SeedDatabase(const SeedDatabase&);
+  SeedDatabase& operator=(const SeedDatabase&);
+};
+
+}
+
+#endif
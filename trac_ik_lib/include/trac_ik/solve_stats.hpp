@@ -0,0 +1,170 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef TRAC_IK_SOLVE_STATS_HPP
+#define TRAC_IK_SOLVE_STATS_HPP
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+namespace TRAC_IK
+{
+
+/* @brief What one TRAC_IK::CartToJnt() call did, filled in only when the
+   caller passes one in (or a SolveStatsCollector is set).  Times are in
+   seconds from the start of the call.
+*/
+struct SolveStats
+{
+  enum Racer { NoRacer, KDLRacer, NLOPTRacer };
+
+  // The kind of racer that found the first solution
+  Racer winner;
+
+  // Which entry of TRAC_IK::getPortfolio() that was, or -1
+  int winning_racer;
+
+  // The kind of racer that was only to start if the others had not
+  // solved the pose by a certain time (RacerSelection Adaptive), or NoRacer
+  Racer held_back;
+
+  // Summed over all racers of each kind
+  long kdl_iterations;
+  long kdl_restarts;
+  long nlopt_evaluations;
+  long nlopt_restarts;
+
+  // Solutions dropped because a racer had already found them, or an
+  // earlier racer of the portfolio had when they are merged
+  long duplicates_rejected;
+
+  int solutions;
+
+  // -1 when nothing was found
+  double time_to_first_solution;
+
+  // Merging the racers' solutions after the race.  The racers keep
+  // separate sets and never lock, so this is the only time the call spends
+  // combining their results.
+  double merge_time;
+
+  double total_time;
+
+  SolveStats()
+  {
+    clear();
+  }
+
+  void clear();
+};
+
+
+/* @brief Totals and histograms over every call recorded, for monitoring to
+   scrape.  Any number of solvers and threads can record into one
+   collector at once: every field is a relaxed atomic counter, so record()
+   never blocks and costs a few dozen additions.
+*/
+class SolveStatsCollector
+{
+public:
+  // Histogram bucket 0 counts zeros and bucket i values from 2^(i-1) up
+  // to 2^i (microseconds, or iterations); the last bucket takes
+  // everything larger
+  static const unsigned int BUCKETS = 24;
+
+  struct Histogram
+  {
+    uint64_t counts[BUCKETS];
+  };
+
+  struct Snapshot
+  {
+    uint64_t calls;
+    uint64_t solved;
+    uint64_t kdl_wins;
+    uint64_t nlopt_wins;
+    uint64_t head_starts;
+    uint64_t kdl_iterations;
+    uint64_t kdl_restarts;
+    uint64_t nlopt_evaluations;
+    uint64_t nlopt_restarts;
+    uint64_t duplicates_rejected;
+    double total_time;
+    double merge_time;
+    double first_solution_time;
+
+    Histogram latency_us;
+    Histogram first_solution_us;
+    Histogram kdl_iterations_per_call;
+    Histogram nlopt_evaluations_per_call;
+  };
+
+  SolveStatsCollector();
+
+  void record(const SolveStats& stats);
+
+  Snapshot snapshot() const;
+
+  void reset();
+
+  // The snapshot in the Prometheus text exposition format, with every
+  // metric name starting with prefix
+  std::string format(const std::string& prefix = "trac_ik") const;
+
+  static unsigned int bucket(uint64_t value);
+
+private:
+  std::atomic<uint64_t> calls;
+  std::atomic<uint64_t> solved;
+  std::atomic<uint64_t> kdl_wins;
+  std::atomic<uint64_t> nlopt_wins;
+  std::atomic<uint64_t> head_starts;
+  std::atomic<uint64_t> kdl_iterations;
+  std::atomic<uint64_t> kdl_restarts;
+  std::atomic<uint64_t> nlopt_evaluations;
+  std::atomic<uint64_t> nlopt_restarts;
+  std::atomic<uint64_t> duplicates_rejected;
+  std::atomic<uint64_t> total_time_ns;
+  std::atomic<uint64_t> merge_time_ns;
+  std::atomic<uint64_t> first_solution_time_ns;
+
+  std::atomic<uint64_t> latency_us[BUCKETS];
+  std::atomic<uint64_t> first_solution_us[BUCKETS];
+  std::atomic<uint64_t> kdl_iterations_per_call[BUCKETS];
+  std::atomic<uint64_t> nlopt_evaluations_per_call[BUCKETS];
+
+  SolveStatsCollector(const SolveStatsCollector&);
+  SolveStatsCollector& operator=(const SolveStatsCollector&);
+};
+
+}
+
+#endif
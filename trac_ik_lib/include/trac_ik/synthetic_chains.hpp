@@ -0,0 +1,153 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef TRAC_IK_SYNTHETIC_CHAINS_HPP
+#define TRAC_IK_SYNTHETIC_CHAINS_HPP
+
+#include <kdl/chain.hpp>
+#include <kdl/jntarray.hpp>
+#include <trac_ik/random.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace TRAC_IK
+{
+
+/* @brief Chains that need no URDF, shared by the unit tests of
+   trac_ik_lib and by trac_ik_benchmarks, so that both exercise the same
+   kinematics.
+*/
+namespace SyntheticChains
+{
+
+// A 7-DOF anthropomorphic arm with alternating yaw/pitch joints
+inline void makeArm7(KDL::Chain& chain, KDL::JntArray& ll, KDL::JntArray& ul)
+{
+  chain = KDL::Chain();
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotZ), KDL::Frame(KDL::Vector(0, 0, 0.31))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotY), KDL::Frame(KDL::Vector(0, 0, 0.2))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotZ), KDL::Frame(KDL::Vector(0, 0, 0.2))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotY), KDL::Frame(KDL::Vector(0, 0, 0.2))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotZ), KDL::Frame(KDL::Vector(0, 0, 0.19))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotY), KDL::Frame(KDL::Vector(0, 0, 0.078))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotZ), KDL::Frame(KDL::Vector(0, 0, 0.05))));
+
+  ll.resize(7);
+  ul.resize(7);
+  for (unsigned int j = 0; j < 7; j++)
+  {
+    ll(j) = -2.9;
+    ul(j) = 2.9;
+  }
+}
+
+// A 6-DOF industrial arm with a spherical wrist and a fixed tool frame
+inline void makeArm6(KDL::Chain& chain, KDL::JntArray& ll, KDL::JntArray& ul)
+{
+  chain = KDL::Chain();
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotZ), KDL::Frame(KDL::Vector(0.15, 0, 0.45))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotY), KDL::Frame(KDL::Vector(0, 0, 0.6))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotY), KDL::Frame(KDL::Vector(0.1, 0, 0.12))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotX), KDL::Frame(KDL::Vector(0.64, 0, 0))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotY), KDL::Frame(KDL::Vector(0.1, 0, 0))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotX), KDL::Frame(KDL::Vector(0.05, 0, 0))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::None), KDL::Frame(KDL::Rotation::RPY(0.1, 0.2, 0.3), KDL::Vector(0.02, 0.01, 0.1))));
+
+  ll.resize(6);
+  ul.resize(6);
+  for (unsigned int j = 0; j < 6; j++)
+  {
+    ll(j) = -2.9;
+    ul(j) = 2.9;
+  }
+}
+
+// A 12-DOF snake of short links with alternating yaw/pitch joints
+inline void makeArm12(KDL::Chain& chain, KDL::JntArray& ll, KDL::JntArray& ul)
+{
+  chain = KDL::Chain();
+  for (unsigned int j = 0; j < 12; j++)
+    chain.addSegment(KDL::Segment(KDL::Joint(j % 2 ? KDL::Joint::RotY : KDL::Joint::RotZ), KDL::Frame(KDL::Vector(0, 0, 0.12))));
+
+  ll.resize(12);
+  ul.resize(12);
+  for (unsigned int j = 0; j < 12; j++)
+  {
+    ll(j) = -2.9;
+    ul(j) = 2.9;
+  }
+}
+
+// The 6-DOF arm on an XY gantry with a vertical lift, mixing 3 prismatic
+// and 6 revolute joints
+inline void makeGantry(KDL::Chain& chain, KDL::JntArray& ll, KDL::JntArray& ul)
+{
+  KDL::Chain arm;
+  KDL::JntArray arm_ll, arm_ul;
+  makeArm6(arm, arm_ll, arm_ul);
+
+  chain = KDL::Chain();
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::TransX), KDL::Frame(KDL::Vector(0, 0, 0))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::TransY), KDL::Frame(KDL::Vector(0, 0, 0))));
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::TransZ), KDL::Frame(KDL::Vector(0, 0, -0.5))));
+  chain.addChain(arm);
+
+  ll.resize(9);
+  ul.resize(9);
+  for (unsigned int j = 0; j < 3; j++)
+  {
+    ll(j) = -1.0;
+    ul(j) = 1.0;
+  }
+  for (unsigned int j = 3; j < 9; j++)
+  {
+    ll(j) = arm_ll(j - 3);
+    ul(j) = arm_ul(j - 3);
+  }
+}
+
+typedef void (*MakeChain)(KDL::Chain&, KDL::JntArray&, KDL::JntArray&);
+
+const MakeChain ALL_CHAINS[] = {makeArm7, makeArm6, makeArm12, makeGantry};
+
+// A configuration within the limits, continuous joints within -pi..pi
+inline KDL::JntArray randomConfig(Random& rng, const KDL::JntArray& ll, const KDL::JntArray& ul)
+{
+  KDL::JntArray q(ll.data.size());
+  for (unsigned int j = 0; j < q.data.size(); j++)
+    q(j) = rng.uniform(std::max(ll(j), -M_PI), std::min(ul(j), M_PI));
+  return q;
+}
+
+}
+
+}
+
+#endif
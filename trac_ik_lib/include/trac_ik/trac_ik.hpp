@@ -33,17 +33,37 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #define TRAC_IK_HPP
 
 #include <trac_ik/nlopt_ik.hpp>
+#include <trac_ik/deadline.hpp>
+#include <trac_ik/racer_scheduler.hpp>
+#include <trac_ik/seed_database.hpp>
+#include <trac_ik/solve_stats.hpp>
+#include <trac_ik/worker_pool.hpp>
 #include <kdl/chainjnttojacsolver.hpp>
-#include <thread>
-#include <mutex>
+#include <atomic>
 #include <memory>
-#include <boost/date_time.hpp>
+#include <mutex>
+#include <unordered_map>
 
 namespace TRAC_IK
 {
 
 enum SolveType { Speed, Distance, Manip1, Manip2 };
 
+// One solver in the race run by every CartToJnt() call
+struct RacerConfig
+{
+  SolveStats::Racer kind; // KDLRacer or NLOPTRacer
+  double damping; // KDL racers only, see ChainIkSolverPos_TL::setDamping()
+  NLOPT_IK::OptType opt_type; // NLOPT racers only
+  KDL::ChainIkSolverPos_TL::StepType step_type; // KDL racers only
+
+  RacerConfig(SolveStats::Racer _kind = SolveStats::KDLRacer, double _damping = 0, NLOPT_IK::OptType _opt_type = NLOPT_IK::SumSq,
+              KDL::ChainIkSolverPos_TL::StepType _step_type = KDL::ChainIkSolverPos_TL::PseudoInverse):
+    kind(_kind), damping(_damping), opt_type(_opt_type), step_type(_step_type)
+  {
+  }
+};
+
 class TRAC_IK
 {
 public:
@@ -83,8 +103,8 @@ public:
   {
     lb = lb_;
     ub = ub_;
-    nl_solver.reset(new NLOPT_IK::NLOPT_IK(chain, lb, ub, maxtime, eps, NLOPT_IK::SumSq));
-    iksolver.reset(new KDL::ChainIkSolverPos_TL(chain, lb, ub, maxtime, eps, true, true));
+    buildRacers();
+    batch_solvers.clear();
     return true;
   }
 
@@ -99,13 +119,102 @@ public:
     return err;
   }
 
-  int CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL::JntArray &q_out, const KDL::Twist& bounds = KDL::Twist::Zero());
+  // If stats is given, it is filled in with what the call did
+  int CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL::JntArray &q_out, const KDL::Twist& bounds = KDL::Twist::Zero(), SolveStats* stats = NULL);
+
+  // Same as above, but only searches within q_lower..q_upper as well as
+  // the joint limits, e.g. to stay near the seed.  Continuous joints are
+  // then bounded too.  If the range of some joint is empty, nothing is
+  // searched and -3 is returned.  Manip1 and Manip2 still penalize closeness to the joint
+  // limits themselves.
+  int CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, const KDL::JntArray &q_lower, const KDL::JntArray &q_upper, KDL::JntArray &q_out, const KDL::Twist& bounds = KDL::Twist::Zero(), SolveStats* stats = NULL);
+
+  // Solves every pose in p_in, spreading the poses over the worker pool.
+  // q_init holds either one seed per pose or a single seed for all of them.
+  // rc[i] is what CartToJnt() would have returned for pose i.  Returns the
+  // number of poses solved, or -1 on bad input.
+  int CartToJntBatch(const std::vector<KDL::JntArray> &q_init, const std::vector<KDL::Frame> &p_in, std::vector<KDL::JntArray> &q_out, std::vector<int> &rc, const KDL::Twist& bounds = KDL::Twist::Zero());
 
   inline void SetSolveType(SolveType _type)
   {
     solvetype = _type;
   }
 
+  inline void setMaxtime(double t)
+  {
+    maxtime = t;
+  }
+
+  // Seeds the random restarts of every racer, and of the solvers of
+  // CartToJntBatch(), from streams derived from this one seed.  Every
+  // instance starts from the same default seed.
+  void setSeed(uint64_t seed);
+
+  // How every racer, and the solvers of CartToJntBatch(), pick their
+  // random restart seeds.  Uniform by default.
+  void setRestartStrategy(RestartStrategy strategy);
+
+  // The solvers raced by CartToJnt(), by default one plain KDL and one
+  // SumSq NLOPT racer.  Each racer draws its own restart stream, the first
+  // solution found stops all of them in Speed mode, and the first racer of
+  // each kind starts from q_init while the others start from a restart.
+  // Every racer needs a thread, so unless a pool was shared, the pool is
+  // grown to one worker per racer besides the calling thread.  Returns
+  // false, and keeps the previous portfolio, if portfolio is empty.
+  bool setPortfolio(const std::vector<RacerConfig>& portfolio);
+
+  // Same as above with makePortfolio(kdl_racers, nlopt_racers)
+  bool setPortfolio(unsigned int kdl_racers, unsigned int nlopt_racers);
+
+  inline const std::vector<RacerConfig>& getPortfolio() const
+  {
+    return portfolio;
+  }
+
+  // kdl_racers KDL racers cycling through plain pseudo-inverse,
+  // Levenberg-Marquardt, and pseudo-inverse damped by 0.01 and 0.03 steps,
+  // followed by nlopt_racers NLOPT racers cycling through the SumSq, L2
+  // and DualQuat objectives
+  static std::vector<RacerConfig> makePortfolio(unsigned int kdl_racers, unsigned int nlopt_racers);
+
+  // Whether Speed solves always start all racers together (the default)
+  // or learn which kind of racer usually wins on this chain and give the
+  // racers of that kind a head start.  Changing it forgets what was
+  // learned.
+  inline void setRacerSelection(RacerSelection selection)
+  {
+    racer_selection = selection;
+    scheduler.reset();
+  }
+
+  // With a database set, every CartToJnt() looks up the k stored
+  // configurations nearest to the target pose.  The first racer starts
+  // from the nearest one and the others as usual; after that all racers
+  // take turns on the rest before any random restart.  Returns false, and
+  // keeps the previous database, if db was built for another chain.
+  // Passing an empty pointer switches the lookup off.
+  bool setSeedDatabase(const std::shared_ptr<const SeedDatabase>& db, unsigned int k = 8);
+
+  // Every CartToJnt() call, including those of CartToJntBatch(), is then
+  // recorded into collector, which can be shared between instances.
+  // Without a collector, and without a stats argument, no statistics are
+  // gathered at all.
+  inline void setStatsCollector(const std::shared_ptr<SolveStatsCollector>& collector)
+  {
+    stats_collector = collector;
+  }
+
+  // The racers run on the threads of this pool.  By default each TRAC_IK
+  // creates its own pool, with one worker per racer besides the calling
+  // thread, on the first call to CartToJnt(); a larger pool can be shared
+  // between instances.
+  inline void setWorkerPool(const std::shared_ptr<WorkerPool>& _pool)
+  {
+    pool = _pool;
+    shared_pool = true;
+    batch_solvers.clear();
+  }
+
 private:
   bool initialized;
   KDL::Chain chain;
@@ -115,38 +224,125 @@ private:
   double maxtime;
   SolveType solvetype;
 
-  std::unique_ptr<NLOPT_IK::NLOPT_IK> nl_solver;
-  std::unique_ptr<KDL::ChainIkSolverPos_TL> iksolver;
+  // When the current CartToJnt() call ends, for all racers
+  Deadline deadline;
 
-  boost::posix_time::ptime start_time;
+  // The distinct solutions found by one racer.  Two solutions are the
+  // same (myEqual) when no joint differs by more than 1e-4, so their joint
+  // sums differ by at most n * 1e-4.  Hashing the sum quantized to that
+  // width therefore only needs a lookup in 3 buckets per solution.
+  class SolutionSet
+  {
+  public:
+    std::vector<KDL::JntArray> solutions;
+    std::vector<double> errors;
+
+    void clear();
+    bool contains(const KDL::JntArray& sol) const;
+    void add(const KDL::JntArray& sol, double err);
+
+  private:
+    std::unordered_multimap<long, size_t> buckets;
 
-  template<typename T1, typename T2>
-  bool runSolver(T1& solver, T2& other_solver,
+    static long bucket(const KDL::JntArray& sol);
+  };
+
+  // One entry of the portfolio: its solver, and what it found and did in
+  // the current call.  Each racer collects into its own set without
+  // locking; the sets are merged into solutions/errors once all racers
+  // are done.
+  struct Racer
+  {
+    RacerConfig config;
+    // Exactly one of these is set, as config.kind says
+    std::unique_ptr<KDL::ChainIkSolverPos_TL> kdl;
+    std::unique_ptr<NLOPT_IK::NLOPT_IK> nlopt;
+    // The first racer of each kind starts from q_init
+    bool first_of_kind;
+
+    SolutionSet found;
+    long work; // KDL iterations or NLOPT objective evaluations
+    long restarts;
+    long duplicates;
+    // Whether it has made an attempt yet
+    bool started;
+
+    void clear();
+    void abort();
+  };
+
+  std::vector<RacerConfig> portfolio;
+  std::vector<std::unique_ptr<Racer> > racers;
+
+  // (Re)creates the racers of the portfolio for the current limits
+  void buildRacers();
+
+  // Runs solver until stop, or in Speed mode until any racer has a
+  // solution.  A racer run before in the same call carries on with its
+  // restarts rather than starting again from the seed.
+  template<typename T>
+  bool runSolver(T& solver,
                  const KDL::JntArray &q_init,
-                 const KDL::Frame &p_in);
+                 const KDL::Frame &p_in,
+                 size_t index,
+                 const Deadline& stop);
 
-  bool runKDL(const KDL::JntArray &q_init, const KDL::Frame &p_in);
-  bool runNLOPT(const KDL::JntArray &q_init, const KDL::Frame &p_in);
+  // runSolver() on the solver of racer index, unless a Speed call is
+  // already solved
+  void runRacer(size_t index, const KDL::JntArray &q_init, const KDL::Frame &p_in, const Deadline& stop);
 
   void normalize_seed(const KDL::JntArray& seed, KDL::JntArray& solution);
   void normalize_limits(const KDL::JntArray& seed, KDL::JntArray& solution);
 
   std::vector<KDL::BasicJointType> types;
 
-  std::mutex mtx_;
+  // The box of the current CartToJnt() call, within lb..ub, where a
+  // bounded continuous joint counts as RotJoint.  Restarts, seeds from
+  // the database and normalization stay within it.
+  KDL::JntArray search_lb, search_ub;
+  std::vector<KDL::BasicJointType> search_types;
+  // Sets the above, and the same box on every racer.  False if the box is
+  // empty.
+  bool setSearchLimits(const KDL::JntArray &q_lower, const KDL::JntArray &q_upper);
+
+  std::atomic<bool> any_solution;
+  // The solutions of all racers, without duplicates
+  SolutionSet merged;
+
+  // Set by whichever racer finds the first solution
+  SolveStats::Racer winner;
+  int winning_racer;
+  double first_solution_time;
+  // Whether the current call reads the clock for SolveStats
+  bool collect_stats;
+  std::shared_ptr<SolveStatsCollector> stats_collector;
+
+  void finishStats(SolveStats* stats, const Deadline::Clock::time_point& merge_start, long merge_duplicates);
+
+  RacerSelection racer_selection;
+  RacerScheduler scheduler;
+
+  // The racers of the kind held back in the current call, if any, are
+  // only dispatched if the favourites have no solution by hold_until
+  SolveStats::Racer held_back;
+  Deadline::Clock::time_point hold_until;
+
   std::vector<KDL::JntArray> solutions;
   std::vector<std::pair<double, uint> >  errors;
 
-  std::thread task1, task2;
-  KDL::Twist bounds;
+  std::shared_ptr<WorkerPool> pool;
+  bool shared_pool;
+  uint64_t rng_seed;
+  RestartStrategy restart_strategy;
 
-  bool unique_solution(const KDL::JntArray& sol);
+  std::shared_ptr<const SeedDatabase> seed_db;
+  unsigned int seed_db_k;
+  // The neighbours of the current target in seed_db, nearest first
+  std::vector<KDL::JntArray> db_seeds;
+  KDL::Twist bounds;
 
-  inline static double fRand(double min, double max)
-  {
-    double f = (double)rand() / RAND_MAX;
-    return min + f * (max - min);
-  }
+  // One solver per concurrent pose in CartToJntBatch(), kept between calls
+  std::vector<std::unique_ptr<TRAC_IK> > batch_solvers;
 
   /* @brief Manipulation metrics and penalties taken from "Workspace
   Geometric Characterization and Manipulability of Industrial Robots",
@@ -157,7 +353,7 @@ private:
   double ManipValue1(const KDL::JntArray&);
   double ManipValue2(const KDL::JntArray&);
 
-  inline bool myEqual(const KDL::JntArray& a, const KDL::JntArray& b)
+  inline static bool myEqual(const KDL::JntArray& a, const KDL::JntArray& b)
   {
     return (a.data - b.data).isZero(1e-4);
   }
@@ -166,16 +362,6 @@ private:
 
 };
 
-inline bool TRAC_IK::runKDL(const KDL::JntArray &q_init, const KDL::Frame &p_in)
-{
-  return runSolver(*iksolver.get(), *nl_solver.get(), q_init, p_in);
-}
-
-inline bool TRAC_IK::runNLOPT(const KDL::JntArray &q_init, const KDL::Frame &p_in)
-{
-  return runSolver(*nl_solver.get(), *iksolver.get(), q_init, p_in);
-}
-
 }
 
 #endif
@@ -0,0 +1,97 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#ifndef TRAC_IK_WORKER_POOL_HPP
+#define TRAC_IK_WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace TRAC_IK
+{
+
+/* @brief A fixed set of long-lived threads that TRAC_IK dispatches its
+   racing solvers onto, instead of creating and joining new threads for
+   every IK call.  A pool may be shared between several TRAC_IK instances.
+
+   The thread calling run() also executes tasks of its own batch while it
+   waits, so a pool with N workers runs up to N+1 tasks at once, a pool
+   with no workers runs everything on the caller, and calling run() from
+   inside a task cannot deadlock.
+*/
+class WorkerPool
+{
+public:
+  explicit WorkerPool(unsigned int num_workers = 1);
+
+  ~WorkerPool();
+
+  // Runs every task and returns once all of them have finished.
+  void run(const std::vector<std::function<void()> >& tasks);
+
+  inline unsigned int size() const
+  {
+    return workers.size();
+  }
+
+private:
+  struct Batch
+  {
+    Batch(const std::vector<std::function<void()> >& _tasks) :
+      tasks(_tasks), next(0), done(0) {}
+
+    const std::vector<std::function<void()> >& tasks;
+    size_t next;
+    size_t done;
+    std::condition_variable finished;
+  };
+
+  void workerLoop();
+
+  // Must be called with mtx_ held and batch.next < batch.tasks.size()
+  size_t claim(Batch& batch);
+
+  std::vector<std::thread> workers;
+  std::deque<Batch*> pending;
+  std::mutex mtx_;
+  std::condition_variable wakeup;
+  bool stopping;
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+};
+
+}
+
+#endif
@@ -0,0 +1,201 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#include <trac_ik/chain_builder.hpp>
+#include <trac_ik/chain_cache.hpp>
+#include <kdl/tree.hpp>
+#include <kdl_parser/kdl_parser.hpp>
+#include <ros/ros.h>
+#include <urdf/model.h>
+#include <algorithm>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+
+namespace TRAC_IK
+{
+
+namespace
+{
+
+struct ParsedUrdf
+{
+  std::string xml;
+  urdf::Model model;
+  KDL::Tree tree;
+};
+
+// Most recently used first
+std::mutex parsed_mtx;
+std::list<std::shared_ptr<const ParsedUrdf> > parsed_urdfs;
+
+std::shared_ptr<const ParsedUrdf> parse(const std::string& urdf_xml)
+{
+  {
+    std::lock_guard<std::mutex> lock(parsed_mtx);
+    for (std::list<std::shared_ptr<const ParsedUrdf> >::iterator it = parsed_urdfs.begin(); it != parsed_urdfs.end(); ++it)
+    {
+      if ((*it)->xml == urdf_xml)
+      {
+        std::shared_ptr<const ParsedUrdf> parsed = *it;
+        parsed_urdfs.erase(it);
+        parsed_urdfs.push_front(parsed);
+        return parsed;
+      }
+    }
+  }
+
+  // Parsed without the lock, so that other URDFs can be looked up meanwhile
+  std::shared_ptr<ParsedUrdf> parsed(new ParsedUrdf);
+  parsed->xml = urdf_xml;
+
+  ROS_DEBUG_STREAM_NAMED("trac_ik", "Reading joints and links from URDF");
+
+  if (!parsed->model.initString(urdf_xml))
+  {
+    ROS_FATAL("Failed to parse the xml robot description");
+    return std::shared_ptr<const ParsedUrdf>();
+  }
+
+  if (!kdl_parser::treeFromUrdfModel(parsed->model, parsed->tree))
+  {
+    ROS_FATAL("Failed to extract kdl tree from xml robot description");
+    return std::shared_ptr<const ParsedUrdf>();
+  }
+
+  std::lock_guard<std::mutex> lock(parsed_mtx);
+  parsed_urdfs.push_front(parsed);
+  if (parsed_urdfs.size() > ChainBuilder::MAX_PARSED_URDFS)
+    parsed_urdfs.pop_back();
+  return parsed;
+}
+
+}
+
+
+bool ChainBuilder::build(const std::string& urdf_xml, const std::string& base_link, const std::string& tip_link,
+                         const ChainCache* cache)
+{
+  clear();
+
+  if (cache && cache->load(urdf_xml, base_link, tip_link, chain, q_min, q_max))
+  {
+    nameJointsAndLinks();
+    return true;
+  }
+
+  std::shared_ptr<const ParsedUrdf> parsed = parse(urdf_xml);
+  if (!parsed)
+    return false;
+
+  if (!parsed->tree.getChain(base_link, tip_link, chain))
+  {
+    ROS_FATAL("Couldn't find chain %s to %s", base_link.c_str(), tip_link.c_str());
+    clear();
+    return false;
+  }
+
+  q_min.resize(chain.getNrOfJoints());
+  q_max.resize(chain.getNrOfJoints());
+
+  uint joint_num = 0;
+  for (unsigned int i = 0; i < chain.getNrOfSegments(); ++i)
+  {
+    const KDL::Joint& kdl_joint = chain.getSegment(i).getJoint();
+    if (kdl_joint.getType() == KDL::Joint::None)
+      continue;
+
+    urdf::JointConstSharedPtr joint = parsed->model.getJoint(kdl_joint.getName());
+
+    if (joint->type != urdf::Joint::CONTINUOUS)
+    {
+      float lower, upper;
+      if (joint->safety)
+      {
+        lower = std::max(joint->limits->lower, joint->safety->soft_lower_limit);
+        upper = std::min(joint->limits->upper, joint->safety->soft_upper_limit);
+      }
+      else
+      {
+        lower = joint->limits->lower;
+        upper = joint->limits->upper;
+      }
+      q_min(joint_num) = lower;
+      q_max(joint_num) = upper;
+    }
+    else
+    {
+      q_min(joint_num) = std::numeric_limits<float>::lowest();
+      q_max(joint_num) = std::numeric_limits<float>::max();
+    }
+    ROS_DEBUG_STREAM_NAMED("trac_ik", "IK Using joint " << joint->name << " " << q_min(joint_num) << " " << q_max(joint_num));
+    joint_num++;
+  }
+
+  nameJointsAndLinks();
+
+  // A chain without joints is of no use to the solvers, never cache one
+  if (cache && chain.getNrOfJoints() > 0)
+    cache->save(urdf_xml, base_link, tip_link, chain, q_min, q_max);
+
+  return true;
+}
+
+
+void ChainBuilder::clearParsedUrdfs()
+{
+  std::lock_guard<std::mutex> lock(parsed_mtx);
+  parsed_urdfs.clear();
+}
+
+
+void ChainBuilder::clear()
+{
+  chain = KDL::Chain();
+  q_min.resize(0);
+  q_max.resize(0);
+  joint_names.clear();
+  link_names.clear();
+}
+
+
+void ChainBuilder::nameJointsAndLinks()
+{
+  for (unsigned int i = 0; i < chain.getNrOfSegments(); ++i)
+  {
+    const KDL::Segment& segment = chain.getSegment(i);
+    link_names.push_back(segment.getName());
+    if (segment.getJoint().getType() != KDL::Joint::None)
+      joint_names.push_back(segment.getJoint().getName());
+  }
+}
+
+}
@@ -0,0 +1,342 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#include <trac_ik/chain_cache.hpp>
+#include <ros/ros.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace TRAC_IK
+{
+
+namespace
+{
+
+const char MAGIC[8] = {'T', 'R', 'A', 'C', 'C', 'H', 'N', 'L'};
+const uint32_t VERSION = 1;
+
+struct Header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t num_segments;
+  uint64_t key;
+  uint32_t num_joints;
+  uint32_t names_size;
+};
+
+// One per segment, followed in the file by the lower and upper limits
+// and then by all the names back to back
+struct SegmentRecord
+{
+  int32_t joint_type;
+  uint32_t name_size;
+  uint32_t joint_name_size;
+  uint32_t reserved;
+  double joint_origin[3];
+  double joint_axis[3];
+  double frame_p[3];
+  double frame_M[9];
+  double mass;
+  double cog[3];
+  double inertia[6]; // about the center of gravity: xx, yy, zz, xy, xz, yz
+};
+
+size_t layoutSize(uint32_t num_segments, uint32_t num_joints, uint32_t names_size)
+{
+  return sizeof(Header) + num_segments * sizeof(SegmentRecord) + 2 * num_joints * sizeof(double) + names_size;
+}
+
+bool makeDirectories(const std::string& directory)
+{
+  for (size_t pos = directory.find('/', 1); pos != std::string::npos; pos = directory.find('/', pos + 1))
+  {
+    std::string prefix = directory.substr(0, pos);
+    if (mkdir(prefix.c_str(), 0775) != 0 && errno != EEXIST)
+      return false;
+  }
+  return mkdir(directory.c_str(), 0775) == 0 || errno == EEXIST;
+}
+
+// Rebuilds the chain from a mapped file; false if it is malformed
+bool parse(const char* data, size_t size, uint64_t key, KDL::Chain& chain, KDL::JntArray& q_min, KDL::JntArray& q_max)
+{
+  if (size < sizeof(Header))
+    return false;
+
+  const Header* header = reinterpret_cast<const Header*>(data);
+  if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION || header->key != key)
+    return false;
+
+  if (size != layoutSize(header->num_segments, header->num_joints, header->names_size))
+    return false;
+
+  const SegmentRecord* records = reinterpret_cast<const SegmentRecord*>(data + sizeof(Header));
+  const double* limits = reinterpret_cast<const double*>(records + header->num_segments);
+  const char* names = reinterpret_cast<const char*>(limits + 2 * header->num_joints);
+  const char* names_end = names + header->names_size;
+
+  KDL::Chain parsed;
+  for (uint32_t i = 0; i < header->num_segments; i++)
+  {
+    const SegmentRecord& record = records[i];
+    if (record.joint_type < KDL::Joint::RotAxis || record.joint_type > KDL::Joint::None ||
+        record.name_size + record.joint_name_size > (size_t)(names_end - names))
+      return false;
+
+    std::string name(names, record.name_size);
+    names += record.name_size;
+    std::string joint_name(names, record.joint_name_size);
+    names += record.joint_name_size;
+
+    KDL::Joint::JointType type = (KDL::Joint::JointType)record.joint_type;
+    KDL::Joint joint;
+    if (type == KDL::Joint::RotAxis || type == KDL::Joint::TransAxis)
+      joint = KDL::Joint(joint_name, KDL::Vector(record.joint_origin[0], record.joint_origin[1], record.joint_origin[2]),
+                         KDL::Vector(record.joint_axis[0], record.joint_axis[1], record.joint_axis[2]), type);
+    else
+      joint = KDL::Joint(joint_name, type);
+
+    const double* M = record.frame_M;
+    KDL::Frame frame(KDL::Rotation(M[0], M[1], M[2], M[3], M[4], M[5], M[6], M[7], M[8]),
+                     KDL::Vector(record.frame_p[0], record.frame_p[1], record.frame_p[2]));
+
+    const double* I = record.inertia;
+    KDL::RigidBodyInertia inertia(record.mass, KDL::Vector(record.cog[0], record.cog[1], record.cog[2]),
+                                  KDL::RotationalInertia(I[0], I[1], I[2], I[3], I[4], I[5]));
+
+    parsed.addSegment(KDL::Segment(name, joint, frame, inertia));
+  }
+
+  if (names != names_end || parsed.getNrOfJoints() != header->num_joints)
+    return false;
+
+  chain = parsed;
+  q_min.resize(header->num_joints);
+  q_max.resize(header->num_joints);
+  for (uint32_t j = 0; j < header->num_joints; j++)
+  {
+    q_min(j) = limits[j];
+    q_max(j) = limits[header->num_joints + j];
+  }
+  return true;
+}
+
+}
+
+
+ChainCache::ChainCache(const std::string& _directory) :
+  directory(_directory)
+{
+}
+
+
+uint64_t ChainCache::key(const std::string& urdf_xml, const std::string& base_link, const std::string& tip_link)
+{
+  // FNV-1a over the URDF and the link names, each with its terminator so
+  // that shifting characters between them changes the hash
+  uint64_t hash = 14695981039346656037ULL;
+  const std::string* parts[] = { &urdf_xml, &base_link, &tip_link };
+  for (unsigned int p = 0; p < 3; p++)
+  {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(parts[p]->c_str());
+    for (size_t i = 0; i <= parts[p]->size(); i++)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+  }
+
+  hash ^= VERSION;
+  hash *= 1099511628211ULL;
+  return hash;
+}
+
+
+std::string ChainCache::path(const std::string& urdf_xml, const std::string& base_link, const std::string& tip_link) const
+{
+  if (directory.empty())
+    return std::string();
+
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.chain", (unsigned long long)key(urdf_xml, base_link, tip_link));
+  return directory + "/" + name;
+}
+
+
+std::string ChainCache::defaultDirectory()
+{
+  const char* ros_home = getenv("ROS_HOME");
+  if (ros_home && *ros_home)
+    return std::string(ros_home) + "/trac_ik_chains";
+
+  const char* home = getenv("HOME");
+  if (home && *home)
+    return std::string(home) + "/.ros/trac_ik_chains";
+
+  return std::string();
+}
+
+
+bool ChainCache::load(const std::string& urdf_xml, const std::string& base_link, const std::string& tip_link,
+                      KDL::Chain& chain, KDL::JntArray& q_min, KDL::JntArray& q_max) const
+{
+  if (directory.empty())
+    return false;
+
+  std::string file = path(urdf_xml, base_link, tip_link);
+
+  // A miss is the normal first start, not an error
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header))
+  {
+    ROS_WARN_NAMED("trac_ik", "Ignoring invalid chain cache %s", file.c_str());
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+    return false;
+
+  bool ok = parse(static_cast<const char*>(data), info.st_size, key(urdf_xml, base_link, tip_link), chain, q_min, q_max);
+  munmap(data, info.st_size);
+
+  if (!ok)
+    ROS_WARN_NAMED("trac_ik", "Ignoring invalid chain cache %s", file.c_str());
+  else
+    ROS_DEBUG_NAMED("trac_ik", "Read chain %s to %s from %s", base_link.c_str(), tip_link.c_str(), file.c_str());
+  return ok;
+}
+
+
+bool ChainCache::save(const std::string& urdf_xml, const std::string& base_link, const std::string& tip_link,
+                      const KDL::Chain& chain, const KDL::JntArray& q_min, const KDL::JntArray& q_max) const
+{
+  if (directory.empty())
+    return false;
+
+  uint32_t num_joints = chain.getNrOfJoints();
+  if (q_min.data.size() != num_joints || q_max.data.size() != num_joints)
+    return false;
+
+  std::vector<SegmentRecord> records(chain.getNrOfSegments());
+  std::string names;
+  for (unsigned int i = 0; i < chain.getNrOfSegments(); i++)
+  {
+    const KDL::Segment& segment = chain.getSegment(i);
+    const KDL::Joint& joint = segment.getJoint();
+    SegmentRecord& record = records[i];
+    memset(&record, 0, sizeof(record));
+
+    record.joint_type = joint.getType();
+    record.name_size = segment.getName().size();
+    record.joint_name_size = joint.getName().size();
+    names += segment.getName();
+    names += joint.getName();
+
+    KDL::Vector origin = joint.JointOrigin();
+    KDL::Vector axis = joint.JointAxis();
+    KDL::Frame frame = segment.getFrameToTip();
+    for (int k = 0; k < 3; k++)
+    {
+      record.joint_origin[k] = origin(k);
+      record.joint_axis[k] = axis(k);
+      record.frame_p[k] = frame.p(k);
+    }
+    std::copy(frame.M.data, frame.M.data + 9, record.frame_M);
+
+    const KDL::RigidBodyInertia& inertia = segment.getInertia();
+    KDL::Vector cog = inertia.getCOG();
+    KDL::RotationalInertia I = inertia.RefPoint(cog).getRotationalInertia();
+    record.mass = inertia.getMass();
+    for (int k = 0; k < 3; k++)
+      record.cog[k] = cog(k);
+    double about_cog[6] = { I.data[0], I.data[4], I.data[8], I.data[1], I.data[2], I.data[5] };
+    std::copy(about_cog, about_cog + 6, record.inertia);
+  }
+
+  Header header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.num_segments = records.size();
+  header.key = key(urdf_xml, base_link, tip_link);
+  header.num_joints = num_joints;
+  header.names_size = names.size();
+
+  if (!makeDirectories(directory))
+  {
+    ROS_WARN_NAMED("trac_ik", "Cannot create chain cache directory %s", directory.c_str());
+    return false;
+  }
+
+  // Written under a temporary name and renamed into place, so a process
+  // starting at the same moment sees either no file or a complete one
+  std::string file = path(urdf_xml, base_link, tip_link);
+  std::string temp = file + "." + std::to_string(getpid()) + ".tmp";
+
+  FILE* out = fopen(temp.c_str(), "wb");
+  if (!out)
+  {
+    ROS_WARN_NAMED("trac_ik", "Cannot write chain cache %s", temp.c_str());
+    return false;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+  if (!records.empty())
+    ok = ok && fwrite(&records[0], sizeof(SegmentRecord), records.size(), out) == records.size();
+  ok = ok && fwrite(q_min.data.data(), sizeof(double), num_joints, out) == num_joints;
+  ok = ok && fwrite(q_max.data.data(), sizeof(double), num_joints, out) == num_joints;
+  ok = ok && fwrite(names.data(), 1, names.size(), out) == names.size();
+  ok = fclose(out) == 0 && ok;
+  ok = ok && rename(temp.c_str(), file.c_str()) == 0;
+
+  if (!ok)
+  {
+    ROS_WARN_NAMED("trac_ik", "Failed writing chain cache %s", file.c_str());
+    unlink(temp.c_str());
+  }
+  return ok;
+}
+
+}
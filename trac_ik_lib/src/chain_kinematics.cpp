@@ -0,0 +1,335 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#include <trac_ik/chain_kinematics.hpp>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+
+namespace KDL
+{
+
+ChainKinematics::ChainKinematics(const Chain& _chain):
+  chain(_chain)
+{
+  bool exact = true;
+  Frame fixed = Frame::Identity();
+
+  for (unsigned int i = 0; i < chain.getNrOfSegments(); i++)
+  {
+    const Segment& segment = chain.getSegment(i);
+    const Joint& joint = segment.getJoint();
+
+    if (joint.getType() == Joint::None)
+    {
+      fixed = fixed * segment.pose(0.0);
+      continue;
+    }
+
+    JointData data;
+    data.rotational = (joint.getType() == Joint::RotAxis || joint.getType() == Joint::RotX ||
+                       joint.getType() == Joint::RotY || joint.getType() == Joint::RotZ);
+    data.axis = joint.JointAxis();
+    data.axis = data.axis / data.axis.Norm();
+    Twist unit = joint.twist(1.0);
+    data.scale = dot(data.rotational ? unit.rot : unit.vel, data.axis);
+
+    // Split the pose at q = 0 (which includes the joint offset) into a
+    // translation before the motion and a rotation after it.  A rotation
+    // about the joint axis commutes with the motion itself.
+    Frame rest = joint.pose(0.0);
+    data.pre = fixed * Frame(rest.p);
+    Frame tip = Frame(rest.M) * rest.Inverse() * segment.pose(0.0);
+
+    for (double q = -2.5; q < 3.0; q += 1.7)
+    {
+      Frame moved = data.rotational ? Frame(Rotation::Rot2(data.axis, data.scale * q)) :
+                    Frame(data.axis * (data.scale * q));
+      if (!Equal(Frame(rest.p) * moved * tip, segment.pose(q), 1e-9))
+        exact = false;
+    }
+
+    joints.push_back(data);
+    fixed = tip;
+  }
+
+  post = fixed;
+
+  if (!exact)
+  {
+    fallback_fk.reset(new ChainFkSolverPos_recursive(chain));
+    fallback_jac.reset(new ChainJntToJacSolver(chain));
+    fallback_q.resize(joints.size());
+  }
+}
+
+int ChainKinematics::JntToCart(const JntArray& q_in, Frame& p_out) const
+{
+  if (q_in.rows() != joints.size())
+    return -1;
+  JntToCart(q_in.data.data(), p_out);
+  return 0;
+}
+
+int ChainKinematics::JntToCartJac(const JntArray& q_in, Frame& p_out, Jacobian& jac) const
+{
+  if (q_in.rows() != joints.size() || jac.columns() != joints.size())
+    return -1;
+  JntToCartJac(q_in.data.data(), p_out, jac);
+  return 0;
+}
+
+void ChainKinematics::JntToCart(const double* q_in, Frame& p_out) const
+{
+  if (fallback_fk)
+  {
+    for (unsigned int i = 0; i < joints.size(); i++)
+      fallback_q(i) = q_in[i];
+    fallback_fk->JntToCart(fallback_q, p_out);
+    return;
+  }
+
+  switch (joints.size())
+  {
+  case 6:
+    fixedJntToCart<6>(q_in, p_out);
+    break;
+  case 7:
+    fixedJntToCart<7>(q_in, p_out);
+    break;
+  default:
+    fixedJntToCart<Eigen::Dynamic>(q_in, p_out);
+    break;
+  }
+}
+
+void ChainKinematics::JntToCartJac(const double* q_in, Frame& p_out, Jacobian& jac) const
+{
+  if (fallback_fk)
+  {
+    for (unsigned int i = 0; i < joints.size(); i++)
+      fallback_q(i) = q_in[i];
+    fallback_fk->JntToCart(fallback_q, p_out);
+    fallback_jac->JntToJac(fallback_q, jac);
+    return;
+  }
+
+  switch (joints.size())
+  {
+  case 6:
+    fixedJntToCartJac<6>(q_in, p_out, jac);
+    break;
+  case 7:
+    fixedJntToCartJac<7>(q_in, p_out, jac);
+    break;
+  default:
+    fixedJntToCartJac<Eigen::Dynamic>(q_in, p_out, jac);
+    break;
+  }
+}
+
+void ChainKinematics::JntToCartBatch(const double* q_in, size_t count, Frame* p_out) const
+{
+  const size_t n = joints.size();
+  const double* lanes[BATCH_WIDTH];
+
+  for (size_t i = 0; i < count; i += BATCH_WIDTH)
+  {
+    int block = std::min(count - i, size_t(BATCH_WIDTH));
+    for (int l = 0; l < block; l++)
+      lanes[l] = q_in + (i + l) * n;
+    blockJntToCart(lanes, block, p_out + i);
+  }
+}
+
+int ChainKinematics::JntToCartBatch(const std::vector<JntArray>& q_in, std::vector<Frame>& p_out) const
+{
+  for (size_t i = 0; i < q_in.size(); i++)
+    if (q_in[i].rows() != joints.size())
+      return -1;
+
+  p_out.resize(q_in.size());
+  const double* lanes[BATCH_WIDTH];
+
+  for (size_t i = 0; i < q_in.size(); i += BATCH_WIDTH)
+  {
+    int block = std::min(q_in.size() - i, size_t(BATCH_WIDTH));
+    for (int l = 0; l < block; l++)
+      lanes[l] = q_in[i + l].data.data();
+    blockJntToCart(lanes, block, &p_out[i]);
+  }
+  return 0;
+}
+
+void ChainKinematics::blockJntToCart(const double* const* q_in, int count, Frame* p_out) const
+{
+  const int W = BATCH_WIDTH;
+
+  if (fallback_fk)
+  {
+    for (int l = 0; l < count; l++)
+      JntToCart(q_in[l], p_out[l]);
+    return;
+  }
+
+  // Unused lanes repeat the last configuration, so that every loop below
+  // runs over all W lanes
+  const double* lanes[W];
+  for (int l = 0; l < W; l++)
+    lanes[l] = q_in[std::min(l, count - 1)];
+
+  // The frame of every lane: rotation R[row][column][lane] and position
+  // p[row][lane]
+  double R[3][3][W], p[3][W];
+  double M[3][3][W], T[3][3][W], q[W], c[W], s[W];
+
+  for (int r = 0; r < 3; r++)
+    for (int l = 0; l < W; l++)
+    {
+      p[r][l] = 0;
+      for (int k = 0; k < 3; k++)
+        R[r][k][l] = (r == k);
+    }
+
+  for (unsigned int i = 0; i < joints.size(); i++)
+  {
+    const JointData& joint = joints[i];
+    for (int l = 0; l < W; l++)
+      q[l] = joint.scale * lanes[l][i];
+
+    // Frame = Frame * pre, with pre the same for every lane
+    for (int r = 0; r < 3; r++)
+      for (int l = 0; l < W; l++)
+        p[r][l] += R[r][0][l] * joint.pre.p(0) + R[r][1][l] * joint.pre.p(1) + R[r][2][l] * joint.pre.p(2);
+    for (int r = 0; r < 3; r++)
+      for (int k = 0; k < 3; k++)
+        for (int l = 0; l < W; l++)
+          T[r][k][l] = R[r][0][l] * joint.pre.M(0, k) + R[r][1][l] * joint.pre.M(1, k) + R[r][2][l] * joint.pre.M(2, k);
+
+    if (!joint.rotational)
+    {
+      for (int r = 0; r < 3; r++)
+        for (int l = 0; l < W; l++)
+          p[r][l] += (T[r][0][l] * joint.axis(0) + T[r][1][l] * joint.axis(1) + T[r][2][l] * joint.axis(2)) * q[l];
+      std::copy(&T[0][0][0], &T[0][0][0] + 9 * W, &R[0][0][0]);
+      continue;
+    }
+
+    // Rotation about the joint axis a, as in Rotation::Rot2:
+    // cos(q) I + sin(q) [a]x + (1 - cos(q)) a a^T
+    for (int l = 0; l < W; l++)
+    {
+      c[l] = std::cos(q[l]);
+      s[l] = std::sin(q[l]);
+    }
+
+    const Vector& a = joint.axis;
+    for (int r = 0; r < 3; r++)
+      for (int k = 0; k < 3; k++)
+      {
+        double cross = (r == k) ? 0 : ((k == (r + 1) % 3) ? -a((r + 2) % 3) : a((r + 1) % 3));
+        for (int l = 0; l < W; l++)
+          M[r][k][l] = (r == k ? c[l] : 0.0) + s[l] * cross + (1 - c[l]) * a(r) * a(k);
+      }
+
+    for (int r = 0; r < 3; r++)
+      for (int k = 0; k < 3; k++)
+        for (int l = 0; l < W; l++)
+          R[r][k][l] = T[r][0][l] * M[0][k][l] + T[r][1][l] * M[1][k][l] + T[r][2][l] * M[2][k][l];
+  }
+
+  for (int l = 0; l < count; l++)
+  {
+    Frame& f = p_out[l];
+    for (int r = 0; r < 3; r++)
+    {
+      f.p(r) = p[r][l];
+      for (int k = 0; k < 3; k++)
+        f.M(r, k) = R[r][k][l];
+    }
+    f = f * post;
+  }
+}
+
+template<int N>
+void ChainKinematics::fixedJntToCart(const double* q_in, Frame& p_out) const
+{
+  const int n = N == Eigen::Dynamic ? joints.size() : N;
+
+  p_out = Frame::Identity();
+  for (int i = 0; i < n; i++)
+  {
+    const JointData& joint = joints[i];
+    p_out = p_out * joint.pre;
+    if (joint.rotational)
+      p_out.M = p_out.M * Rotation::Rot2(joint.axis, joint.scale * q_in[i]);
+    else
+      p_out.p = p_out.p + p_out.M * joint.axis * (joint.scale * q_in[i]);
+  }
+  p_out = p_out * post;
+}
+
+template<int N>
+void ChainKinematics::fixedJntToCartJac(const double* q_in, Frame& p_out, Jacobian& jac) const
+{
+  const int n = N == Eigen::Dynamic ? joints.size() : N;
+  Eigen::Map<Eigen::Matrix<double, 6, N> > columns(jac.data.data(), 6, n);
+
+  // Columns are first taken about the base origin, where they only depend
+  // on the frame the joint moves in, and moved to the tip at the end.
+  p_out = Frame::Identity();
+  for (int i = 0; i < n; i++)
+  {
+    const JointData& joint = joints[i];
+    p_out = p_out * joint.pre;
+    Vector axis = p_out.M * joint.axis * joint.scale;
+    Vector vel, rot;
+    if (joint.rotational)
+    {
+      rot = axis;
+      vel = p_out.p * axis;
+      p_out.M = p_out.M * Rotation::Rot2(joint.axis, joint.scale * q_in[i]);
+    }
+    else
+    {
+      vel = axis;
+      rot = Vector::Zero();
+      p_out.p = p_out.p + axis * q_in[i];
+    }
+    columns.col(i) << vel.x(), vel.y(), vel.z(), rot.x(), rot.y(), rot.z();
+  }
+  p_out = p_out * post;
+
+  Eigen::Vector3d tip(p_out.p.x(), p_out.p.y(), p_out.p.z());
+  for (int i = 0; i < n; i++)
+    columns.col(i).template head<3>() += columns.col(i).template tail<3>().cross(tip);
+}
+
+}
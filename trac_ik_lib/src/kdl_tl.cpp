@@ -29,15 +29,104 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 ********************************************************************************/
 
 #include <trac_ik/kdl_tl.hpp>
-#include <boost/date_time.hpp>
+#include <Eigen/Eigenvalues>
+#include <boost/math/tools/precision.hpp>
 #include <ros/ros.h>
+#include <algorithm>
 #include <limits>
 
+namespace
+{
+
+// The Levenberg-Marquardt bias starts at LM_INITIAL_BIAS, is multiplied
+// by LM_BIAS_SCALE after every rejected step and divided by it after every
+// accepted one, but not below LM_MIN_BIAS.  Beyond LM_MAX_BIAS the steps
+// are too small to matter, so the solver counts as stuck.
+const double LM_INITIAL_BIAS = 1e-3;
+const double LM_MIN_BIAS = 1e-9;
+const double LM_MAX_BIAS = 1e6;
+const double LM_BIAS_SCALE = 10;
+
+// An accepted step that removes less than this share of the error means a
+// local minimum, which Levenberg-Marquardt would otherwise creep into
+// forever
+const double LM_MIN_PROGRESS = 1e-2;
+
+// The smallest squared singular value the EigenPseudoInverse step keeps,
+// the square of the cutoff of the SVD step
+const double EIGEN_MIN_SIGMA2 = 1e-10;
+
+typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+// dq = pinv(J) dx from the SVD of J, dropping the same small singular
+// values ChainIkSolverVel_pinv does, or damped when damping > 0
+template<typename SVD>
+void pseudoInverseStep(const SVD& svd, const Vector6d& dx, double damping, Eigen::VectorXd& dq)
+{
+  int rank = svd.singularValues().size();
+  Eigen::Matrix<double, Eigen::Dynamic, 1, 0, 6, 1> tmp = svd.matrixU().leftCols(rank).transpose() * dx;
+  for (int i = 0; i < rank; i++)
+  {
+    double sigma = svd.singularValues()(i);
+    if (damping > 0)
+      tmp(i) *= sigma / (sigma * sigma + damping * damping);
+    else
+      tmp(i) = sigma < 0.00001 ? 0.0 : tmp(i) / sigma;
+  }
+  dq.noalias() = svd.matrixV().leftCols(rank) * tmp;
+}
+
+// The EigenPseudoInverse step for chains of 6 joints or more, from the
+// eigenvectors u_i and eigenvalues sigma_i^2 of J J^T, which are the left
+// singular vectors and squared singular values of J.  With
+// v_i = J^T u_i / sigma_i, each term sigma_i^-1 v_i u_i^T dx of the
+// pseudo-inverse becomes sigma_i^-2 J^T u_i u_i^T dx, so a 6x6 eigensolver
+// replaces the SVD.  Forming J J^T squares the condition number, so the
+// sigma_i^2 below about 1e-10 are too inexact to keep.
+template<typename Matrix>
+void eigenPseudoInverseStep(const Matrix& J, const Vector6d& dx, double damping, Eigen::VectorXd& dq)
+{
+  Eigen::Matrix<double, 6, 6> jjt;
+  jjt.noalias() = J * J.transpose();
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 6, 6> > eigen(jjt);
+
+  Vector6d tmp = eigen.eigenvectors().transpose() * dx;
+  for (int i = 0; i < 6; i++)
+  {
+    double sigma2 = std::max(eigen.eigenvalues()(i), 0.0);
+    if (damping > 0)
+      tmp(i) /= sigma2 + damping * damping;
+    else
+      tmp(i) = sigma2 < EIGEN_MIN_SIGMA2 ? 0.0 : tmp(i) / sigma2;
+  }
+  Vector6d y = eigen.eigenvectors() * tmp;
+  dq.noalias() = J.transpose() * y;
+}
+
+// dq = J^T (J J^T + lambda^2 I)^-1 dx, which for any number of joints only
+// needs a 6x6 solve
+template<typename Matrix>
+void dampedLeastSquaresStep(const Matrix& J, Eigen::LLT<Eigen::Matrix<double, 6, 6> >& llt, const Vector6d& dx, double lambda2, Eigen::VectorXd& dq)
+{
+  Eigen::Matrix<double, 6, 6> jjt;
+  jjt.noalias() = J * J.transpose();
+  jjt.diagonal().array() += lambda2;
+  llt.compute(jjt);
+  Vector6d y = llt.solve(dx);
+  dq.noalias() = J.transpose() * y;
+}
+
+}
+
 namespace KDL
 {
 ChainIkSolverPos_TL::ChainIkSolverPos_TL(const Chain& _chain, const JntArray& _q_min, const JntArray& _q_max, double _maxtime, double _eps, bool _random_restart, bool _try_jl_wrap):
-  chain(_chain), q_min(_q_min), q_max(_q_max), vik_solver(_chain), fksolver(_chain), delta_q(_chain.getNrOfJoints()),
-  maxtime(_maxtime), eps(_eps), rr(_random_restart), wrap(_try_jl_wrap)
+  chain(_chain), q_min(_q_min), q_max(_q_max), joint_min(_q_min), joint_max(_q_max), empty_search(false), kinematics(_chain), jac(_chain.getNrOfJoints()),
+  svd_input(6, _chain.getNrOfJoints()), svd(6, _chain.getNrOfJoints(), Eigen::ComputeThinU | Eigen::ComputeThinV),
+  delta_q(_chain.getNrOfJoints()), q_curr(_chain.getNrOfJoints()),
+  maxtime(_maxtime), iterations(0), eps(_eps), damping(0), step_type(PseudoInverse),
+  lm_q(_chain.getNrOfJoints()), lm_jac(6, _chain.getNrOfJoints()), rr(_random_restart), wrap(_try_jl_wrap),
+  restarts(_chain.getNrOfJoints()), restart_lower(_chain.getNrOfJoints()), restart_upper(_chain.getNrOfJoints())
 {
 
   assert(chain.getNrOfJoints() == _q_min.data.size());
@@ -61,27 +150,68 @@ ChainIkSolverPos_TL::ChainIkSolverPos_TL(const Chain& _chain, const JntArray& _q
   }
 
   assert(types.size() == _q_max.data.size());
+  joint_types = types;
+}
+
+
+bool ChainIkSolverPos_TL::setSearchLimits(const JntArray& lower, const JntArray& upper)
+{
+  assert(lower.data.size() == joint_min.data.size());
+  assert(upper.data.size() == joint_max.data.size());
+
+  empty_search = false;
+  for (unsigned int j = 0; j < joint_min.data.size(); j++)
+  {
+    q_min(j) = std::max(joint_min(j), lower(j));
+    q_max(j) = std::min(joint_max(j), upper(j));
+    if (q_min(j) > q_max(j))
+      empty_search = true;
+
+    types[j] = joint_types[j];
+    if (types[j] == KDL::BasicJointType::Continuous &&
+        (q_max(j) < std::numeric_limits<float>::max() || q_min(j) > std::numeric_limits<float>::lowest()))
+      types[j] = KDL::BasicJointType::RotJoint;
+  }
+
+  return !empty_search;
+}
+
+
+void ChainIkSolverPos_TL::clearSearchLimits()
+{
+  q_min = joint_min;
+  q_max = joint_max;
+  types = joint_types;
+  empty_search = false;
 }
 
 
 
 int ChainIkSolverPos_TL::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL::JntArray &q_out, const KDL::Twist _bounds)
 {
+  restarts.reset();
+  return CartToJnt(q_init, p_in, q_out, TRAC_IK::Deadline(maxtime), _bounds);
+}
+
+
+int ChainIkSolverPos_TL::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL::JntArray &q_out, const TRAC_IK::Deadline& deadline, const KDL::Twist _bounds)
+{
+  iterations = 0;
 
   if (aborted)
     return -3;
 
-  boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::local_time();
-  boost::posix_time::time_duration timediff;
   q_out = q_init;
-  bounds = _bounds;
-
+  if (empty_search)
+    return -3;
 
-  double time_left;
+  bounds = _bounds;
+  resetLM();
 
   do
   {
-    fksolver.JntToCart(q_out, f);
+    iterations++;
+    kinematics.JntToCartJac(q_out, f, jac);
     delta_twist = diffRelative(p_in, f);
 
     if (std::abs(delta_twist.vel.x()) <= std::abs(bounds.vel.x()))
@@ -107,8 +237,42 @@ int ChainIkSolverPos_TL::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame
 
     delta_twist = diff(f, p_in);
 
-    vik_solver.CartToJnt(q_out, delta_twist, delta_q);
-    KDL::JntArray q_curr;
+    Eigen::Matrix<double, 6, 1> dx;
+    for (unsigned int i = 0; i < 6; i++)
+      dx(i) = delta_twist(i);
+
+    if (step_type == LevenbergMarquardt)
+    {
+      double error = 0.5 * dx.squaredNorm();
+      if (error > lm_error)
+      {
+        // The last step made things worse: go back and take a shorter one
+        lm_bias *= LM_BIAS_SCALE;
+        q_out = lm_q;
+        jac.data = lm_jac;
+        dx = lm_dx;
+        error = lm_error;
+      }
+      else if (error > (1 - LM_MIN_PROGRESS) * lm_error)
+        lm_bias = LM_MAX_BIAS * LM_BIAS_SCALE;
+      else
+      {
+        lm_bias = std::max(lm_bias / LM_BIAS_SCALE, LM_MIN_BIAS);
+        lm_q = q_out;
+        lm_jac = jac.data;
+        lm_dx = dx;
+        lm_error = error;
+      }
+
+      // Damping by the error itself makes the steps Gauss-Newton steps
+      // near the solution
+      if (lm_bias > LM_MAX_BIAS)
+        delta_q.data.setZero();
+      else
+        step(dx, error + lm_bias);
+    }
+    else
+      step(dx, 0);
 
     Add(q_out, delta_q, q_curr);
 
@@ -168,9 +332,17 @@ int ChainIkSolverPos_TL::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame
       {
         for (unsigned int j = 0; j < q_out.data.size(); j++)
           if (types[j] == KDL::BasicJointType::Continuous)
-            q_curr(j) = fRand(q_curr(j) - 2 * M_PI, q_curr(j) + 2 * M_PI);
+          {
+            restart_lower(j) = q_curr(j) - 2 * M_PI;
+            restart_upper(j) = q_curr(j) + 2 * M_PI;
+          }
           else
-            q_curr(j) = fRand(q_min(j), q_max(j));
+          {
+            restart_lower(j) = q_min(j);
+            restart_upper(j) = q_max(j);
+          }
+        restarts.sample(restart_lower.data.data(), restart_upper.data.data(), q_curr.data.data());
+        resetLM();
       }
 
       // Below would be an optimization to the normal KDL, where when it
@@ -184,15 +356,59 @@ int ChainIkSolverPos_TL::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame
     }
 
     q_out = q_curr;
-
-    timediff = boost::posix_time::microsec_clock::local_time() - start_time;
-    time_left = maxtime - timediff.total_nanoseconds() / 1000000000.0;
   }
-  while (time_left > 0 && !aborted);
+  while (!deadline.expired() && !aborted);
 
   return -3;
 }
 
+template<int N>
+void ChainIkSolverPos_TL::fixedStep(const Eigen::Matrix<double, 6, 1>& dx, double lambda2)
+{
+  const Eigen::Matrix<double, 6, N> J = jac.data;
+  if (step_type == LevenbergMarquardt)
+    dampedLeastSquaresStep(J, lm_llt, dx, lambda2, delta_q.data);
+  else if (step_type == EigenPseudoInverse)
+    eigenPseudoInverseStep(J, dx, damping, delta_q.data);
+  else
+  {
+    // Fixed-size decompositions only compute full U and V
+    Eigen::JacobiSVD<Eigen::Matrix<double, 6, N> > fixed_svd(J, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    pseudoInverseStep(fixed_svd, dx, damping, delta_q.data);
+  }
+}
+
+void ChainIkSolverPos_TL::step(const Eigen::Matrix<double, 6, 1>& dx, double lambda2)
+{
+  switch (jac.columns())
+  {
+  case 6:
+    fixedStep<6>(dx, lambda2);
+    break;
+  case 7:
+    fixedStep<7>(dx, lambda2);
+    break;
+  default:
+    if (step_type == LevenbergMarquardt)
+      dampedLeastSquaresStep(jac.data, lm_llt, dx, lambda2, delta_q.data);
+    else if (step_type == EigenPseudoInverse && jac.columns() >= 6)
+      eigenPseudoInverseStep(jac.data, dx, damping, delta_q.data);
+    else
+    {
+      svd_input = jac.data;
+      svd.compute(svd_input);
+      pseudoInverseStep(svd, dx, damping, delta_q.data);
+    }
+    break;
+  }
+}
+
+void ChainIkSolverPos_TL::resetLM()
+{
+  lm_error = std::numeric_limits<double>::infinity();
+  lm_bias = LM_INITIAL_BIAS;
+}
+
 ChainIkSolverPos_TL::~ChainIkSolverPos_TL()
 {
 }
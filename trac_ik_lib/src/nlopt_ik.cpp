@@ -30,8 +30,9 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <trac_ik/nlopt_ik.hpp>
 #include <ros/ros.h>
+#include <algorithm>
 #include <limits>
-#include <boost/date_time.hpp>
+#include <boost/math/tools/precision.hpp>
 #include <trac_ik/dual_quaternion.h>
 #include <cmath>
 
@@ -40,8 +41,6 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 namespace NLOPT_IK
 {
 
-dual_quaternion targetDQ;
-
 double minfunc(const std::vector<double>& x, std::vector<double>& grad, void* data)
 {
   // Auxilory function to minimize (Sum of Squared joint angle error
@@ -62,26 +61,8 @@ double minfuncDQ(const std::vector<double>& x, std::vector<double>& grad, void*
   // passing methods of Classes, we use these auxilary functions.
   NLOPT_IK *c = (NLOPT_IK *) data;
 
-  std::vector<double> vals(x);
-
-  double jump = boost::math::tools::epsilon<float>();
   double result[1];
-  c->cartDQError(vals, result);
-
-  if (!grad.empty())
-  {
-    double v1[1];
-    for (uint i = 0; i < x.size(); i++)
-    {
-      double original = vals[i];
-
-      vals[i] = original + jump;
-      c->cartDQError(vals, v1);
-
-      vals[i] = original;
-      grad[i] = (v1[0] - result[0]) / (2 * jump);
-    }
-  }
+  c->cartDQError(x, result, grad.empty() ? NULL : grad.data());
 
   return result[0];
 }
@@ -96,26 +77,8 @@ double minfuncSumSquared(const std::vector<double>& x, std::vector<double>& grad
 
   NLOPT_IK *c = (NLOPT_IK *) data;
 
-  std::vector<double> vals(x);
-
-  double jump = boost::math::tools::epsilon<float>();
   double result[1];
-  c->cartSumSquaredError(vals, result);
-
-  if (!grad.empty())
-  {
-    double v1[1];
-    for (uint i = 0; i < x.size(); i++)
-    {
-      double original = vals[i];
-
-      vals[i] = original + jump;
-      c->cartSumSquaredError(vals, v1);
-
-      vals[i] = original;
-      grad[i] = (v1[0] - result[0]) / (2.0 * jump);
-    }
-  }
+  c->cartSumSquaredError(x, result, grad.empty() ? NULL : grad.data());
 
   return result[0];
 }
@@ -130,26 +93,8 @@ double minfuncL2(const std::vector<double>& x, std::vector<double>& grad, void*
 
   NLOPT_IK *c = (NLOPT_IK *) data;
 
-  std::vector<double> vals(x);
-
-  double jump = boost::math::tools::epsilon<float>();
   double result[1];
-  c->cartL2NormError(vals, result);
-
-  if (!grad.empty())
-  {
-    double v1[1];
-    for (uint i = 0; i < x.size(); i++)
-    {
-      double original = vals[i];
-
-      vals[i] = original + jump;
-      c->cartL2NormError(vals, v1);
-
-      vals[i] = original;
-      grad[i] = (v1[0] - result[0]) / (2.0 * jump);
-    }
-  }
+  c->cartL2NormError(x, result, grad.empty() ? NULL : grad.data());
 
   return result[0];
 }
@@ -159,42 +104,19 @@ double minfuncL2(const std::vector<double>& x, std::vector<double>& grad, void*
 void constrainfuncm(uint m, double* result, uint n, const double* x, double* grad, void* data)
 {
   //Equality constraint auxilary function for Euclidean distance .
-  //This also uses a small walk to approximate the gradient of the
-  //constraint function at the current joint angles.
+  //The gradient of the single constraint comes from the chain Jacobian.
 
   NLOPT_IK *c = (NLOPT_IK *) data;
 
-  std::vector<double> vals(n);
+  std::vector<double> vals(x, x + n);
 
-  for (uint i = 0; i < n; i++)
-  {
-    vals[i] = x[i];
-  }
-
-  double jump = boost::math::tools::epsilon<float>();
-
-  c->cartSumSquaredError(vals, result);
-
-  if (grad != NULL)
-  {
-    std::vector<double> v1(m);
-    for (uint i = 0; i < n; i++)
-    {
-      double o = vals[i];
-      vals[i] = o + jump;
-      c->cartSumSquaredError(vals, v1.data());
-      vals[i] = o;
-      for (uint j = 0; j < m; j++)
-      {
-        grad[j * n + i] = (v1[j] - result[j]) / (2 * jump);
-      }
-    }
-  }
+  c->cartSumSquaredError(vals, result, grad);
 }
 
 
 NLOPT_IK::NLOPT_IK(const KDL::Chain& _chain, const KDL::JntArray& _q_min, const KDL::JntArray& _q_max, double _maxtime, double _eps, OptType _type):
-  chain(_chain), fksolver(_chain), maxtime(_maxtime), eps(std::abs(_eps)), TYPE(_type)
+  chain(_chain), kinematics(_chain), jac(_chain.getNrOfJoints()), maxtime(_maxtime), eps(std::abs(_eps)), iter_counter(0), TYPE(_type), empty_search(false),
+  targetDQ(new dual_quaternion()), restarts(_chain.getNrOfJoints())
 {
   assert(chain.getNrOfJoints() == _q_min.data.size());
   assert(chain.getNrOfJoints() == _q_max.data.size());
@@ -233,6 +155,9 @@ NLOPT_IK::NLOPT_IK(const KDL::Chain& _chain, const KDL::JntArray& _q_min, const
   }
 
   assert(types.size() == lb.size());
+  joint_lb = lb;
+  joint_ub = ub;
+  joint_types = types;
 
   std::vector<double> tolerance(1, boost::math::tools::epsilon<float>());
   opt.set_xtol_abs(tolerance[0]);
@@ -257,6 +182,41 @@ NLOPT_IK::NLOPT_IK(const KDL::Chain& _chain, const KDL::JntArray& _q_min, const
 }
 
 
+bool NLOPT_IK::setSearchLimits(const KDL::JntArray& lower, const KDL::JntArray& upper)
+{
+  empty_search = false;
+  // Empty when the chain was too short to set up the optimizer
+  for (uint i = 0; i < joint_lb.size(); i++)
+  {
+    lb[i] = std::max(joint_lb[i], lower(i));
+    ub[i] = std::min(joint_ub[i], upper(i));
+    if (lb[i] > ub[i])
+      empty_search = true;
+
+    types[i] = joint_types[i];
+    if (types[i] == KDL::BasicJointType::Continuous &&
+        (ub[i] < std::numeric_limits<float>::max() || lb[i] > std::numeric_limits<float>::lowest()))
+      types[i] = KDL::BasicJointType::RotJoint;
+  }
+
+  return !empty_search;
+}
+
+
+void NLOPT_IK::clearSearchLimits()
+{
+  lb = joint_lb;
+  ub = joint_ub;
+  types = joint_types;
+  empty_search = false;
+}
+
+
+NLOPT_IK::~NLOPT_IK()
+{
+}
+
+
 double NLOPT_IK::minJoints(const std::vector<double>& x, std::vector<double>& grad)
 {
   // Actual function to compute the error between the current joint
@@ -278,7 +238,7 @@ double NLOPT_IK::minJoints(const std::vector<double>& x, std::vector<double>& gr
 }
 
 
-void NLOPT_IK::cartSumSquaredError(const std::vector<double>& x, double error[])
+void NLOPT_IK::cartSumSquaredError(const std::vector<double>& x, double error[], double grad[])
 {
   // Actual function to compute Euclidean distance error.  This uses
   // the KDL Forward Kinematics solver to compute the Cartesian pose
@@ -288,29 +248,30 @@ void NLOPT_IK::cartSumSquaredError(const std::vector<double>& x, double error[])
   if (aborted || progress != -3)
   {
     opt.force_stop();
+    if (grad != NULL)
+      std::fill(grad, grad + x.size(), 0.0);
     return;
   }
 
+  iter_counter++;
 
-  KDL::JntArray q(x.size());
-
-  for (uint i = 0; i < x.size(); i++)
-    q(i) = x[i];
-
-  int rc = fksolver.JntToCart(q, currentPose);
-
-  if (rc < 0)
-    ROS_FATAL_STREAM("KDL FKSolver is failing: " << q.data);
+  if (grad != NULL)
+    kinematics.JntToCartJac(x.data(), currentPose, jac);
+  else
+    kinematics.JntToCart(x.data(), currentPose);
 
   if (std::isnan(currentPose.p.x()))
   {
     ROS_ERROR("NaNs from NLOpt!!");
     error[0] = std::numeric_limits<float>::max();
+    if (grad != NULL)
+      std::fill(grad, grad + x.size(), 0.0);
     progress = -1;
     return;
   }
 
-  KDL::Twist delta_twist = KDL::diffRelative(targetPose, currentPose);
+  currentTwist = KDL::diffRelative(targetPose, currentPose);
+  KDL::Twist delta_twist = currentTwist;
 
   for (int i = 0; i < 6; i++)
   {
@@ -318,8 +279,13 @@ void NLOPT_IK::cartSumSquaredError(const std::vector<double>& x, double error[])
       delta_twist[i] = 0.0;
   }
 
+  currentError = delta_twist;
+
   error[0] = KDL::dot(delta_twist.vel, delta_twist.vel) + KDL::dot(delta_twist.rot, delta_twist.rot);
 
+  if (grad != NULL)
+    sumSquaredGradient(grad);
+
   if (KDL::Equal(delta_twist, KDL::Twist::Zero(), eps))
   {
     progress = 1;
@@ -330,7 +296,7 @@ void NLOPT_IK::cartSumSquaredError(const std::vector<double>& x, double error[])
 
 
 
-void NLOPT_IK::cartL2NormError(const std::vector<double>& x, double error[])
+void NLOPT_IK::cartL2NormError(const std::vector<double>& x, double error[], double grad[])
 {
   // Actual function to compute Euclidean distance error.  This uses
   // the KDL Forward Kinematics solver to compute the Cartesian pose
@@ -340,36 +306,40 @@ void NLOPT_IK::cartL2NormError(const std::vector<double>& x, double error[])
   if (aborted || progress != -3)
   {
     opt.force_stop();
+    if (grad != NULL)
+      std::fill(grad, grad + x.size(), 0.0);
     return;
   }
 
-  KDL::JntArray q(x.size());
+  iter_counter++;
 
   if (std::isnan(currentPose.p.x())) {
     ROS_ERROR("NaNs from NLOpt!!");
     error[0] = std::numeric_limits<float>::max();
+    if (grad != NULL)
+      std::fill(grad, grad + x.size(), 0.0);
     progress = -1;
     return;
   }
 
-  for (uint i = 0; i < x.size(); i++)
-    q(i) = x[i];
-
-  int rc = fksolver.JntToCart(q, currentPose);
-
-  if (rc < 0)
-    ROS_FATAL_STREAM("KDL FKSolver is failing: " << q.data);
+  if (grad != NULL)
+    kinematics.JntToCartJac(x.data(), currentPose, jac);
+  else
+    kinematics.JntToCart(x.data(), currentPose);
 
 
   if (std::isnan(currentPose.p.x()))
   {
     ROS_ERROR("NaNs from NLOpt!!");
     error[0] = std::numeric_limits<float>::max();
+    if (grad != NULL)
+      std::fill(grad, grad + x.size(), 0.0);
     progress = -1;
     return;
   }
 
-  KDL::Twist delta_twist = KDL::diffRelative(targetPose, currentPose);
+  currentTwist = KDL::diffRelative(targetPose, currentPose);
+  KDL::Twist delta_twist = currentTwist;
 
   for (int i = 0; i < 6; i++)
   {
@@ -377,8 +347,13 @@ void NLOPT_IK::cartL2NormError(const std::vector<double>& x, double error[])
       delta_twist[i] = 0.0;
   }
 
+  currentError = delta_twist;
+
   error[0] = std::sqrt(KDL::dot(delta_twist.vel, delta_twist.vel) + KDL::dot(delta_twist.rot, delta_twist.rot));
 
+  if (grad != NULL)
+    l2NormGradient(grad);
+
   if (KDL::Equal(delta_twist, KDL::Twist::Zero(), eps))
   {
     progress = 1;
@@ -387,7 +362,7 @@ void NLOPT_IK::cartL2NormError(const std::vector<double>& x, double error[])
   }
 }
 
-void NLOPT_IK::cartDQError(const std::vector<double>& x, double error[])
+void NLOPT_IK::cartDQError(const std::vector<double>& x, double error[], double grad[])
 {
   // Actual function to compute Euclidean distance error.  This uses
   // the KDL Forward Kinematics solver to compute the Cartesian pose
@@ -397,29 +372,31 @@ void NLOPT_IK::cartDQError(const std::vector<double>& x, double error[])
   if (aborted || progress != -3)
   {
     opt.force_stop();
+    if (grad != NULL)
+      std::fill(grad, grad + x.size(), 0.0);
     return;
   }
 
-  KDL::JntArray q(x.size());
-
-  for (uint i = 0; i < x.size(); i++)
-    q(i) = x[i];
-
-  int rc = fksolver.JntToCart(q, currentPose);
+  iter_counter++;
 
-  if (rc < 0)
-    ROS_FATAL_STREAM("KDL FKSolver is failing: " << q.data);
+  if (grad != NULL)
+    kinematics.JntToCartJac(x.data(), currentPose, jac);
+  else
+    kinematics.JntToCart(x.data(), currentPose);
 
 
   if (std::isnan(currentPose.p.x()))
   {
     ROS_ERROR("NaNs from NLOpt!!");
     error[0] = std::numeric_limits<float>::max();
+    if (grad != NULL)
+      std::fill(grad, grad + x.size(), 0.0);
     progress = -1;
     return;
   }
 
-  KDL::Twist delta_twist = KDL::diffRelative(targetPose, currentPose);
+  currentTwist = KDL::diffRelative(targetPose, currentPose);
+  KDL::Twist delta_twist = currentTwist;
 
   for (int i = 0; i < 6; i++)
   {
@@ -427,14 +404,12 @@ void NLOPT_IK::cartDQError(const std::vector<double>& x, double error[])
       delta_twist[i] = 0.0;
   }
 
-  math3d::matrix3x3<double> currentRotationMatrix(currentPose.M.data);
-  math3d::quaternion<double> currentQuaternion = math3d::rot_matrix_to_quaternion<double>(currentRotationMatrix);
-  math3d::point3d currentTranslation(currentPose.p.data);
-  dual_quaternion currentDQ = dual_quaternion::rigid_transformation(currentQuaternion, currentTranslation);
+  currentError = delta_twist;
 
-  dual_quaternion errorDQ = (currentDQ * !targetDQ).normalize();
-  errorDQ.log();
-  error[0] = 4.0f * dot(errorDQ, errorDQ);
+  error[0] = dqError(currentPose);
+
+  if (grad != NULL)
+    dqGradient(grad);
 
 
   if (KDL::Equal(delta_twist, KDL::Twist::Zero(), eps))
@@ -446,7 +421,152 @@ void NLOPT_IK::cartDQError(const std::vector<double>& x, double error[])
 }
 
 
+double NLOPT_IK::dqError(const KDL::Frame& pose) const
+{
+  math3d::matrix3x3<double> currentRotationMatrix(pose.M.data);
+  math3d::quaternion<double> currentQuaternion = math3d::rot_matrix_to_quaternion<double>(currentRotationMatrix);
+  math3d::point3d currentTranslation(pose.p.data);
+  dual_quaternion currentDQ = dual_quaternion::rigid_transformation(currentQuaternion, currentTranslation);
+
+  dual_quaternion errorDQ = (currentDQ * !*targetDQ).normalize();
+  errorDQ.log();
+  return 4.0f * dot(errorDQ, errorDQ);
+}
+
+
+void NLOPT_IK::twistGradient(const Eigen::Matrix<double, 6, 1>& twist_grad, double grad[]) const
+{
+  // Derivative of currentTwist = diffRelative(targetPose, currentPose).
+  // With R_t the target rotation and J the base frame Jacobian at the
+  // tip, the translation part is R_t^T * J_v.  The rotation part is the
+  // rotation vector phi of R_t^T * R_c, whose derivative is
+  // Jl^-1(phi) * R_t^T * J_w, with Jl^-1 the inverse left Jacobian of
+  // SO(3).  The chain rule is applied from the left, so that only the
+  // final product involves the joints.
+
+  Eigen::Matrix3d Rt_inv = Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor> >(targetPose.M.data).transpose();
+
+  Eigen::Vector3d phi(currentTwist.rot.x(), currentTwist.rot.y(), currentTwist.rot.z());
+  double theta = phi.norm();
+
+  Eigen::Matrix3d phi_x;
+  phi_x << 0, -phi(2), phi(1),
+        phi(2), 0, -phi(0),
+        -phi(1), phi(0), 0;
+
+  double coeff;
+  if (theta < 1e-4)
+    coeff = 1.0 / 12.0;
+  else if (M_PI - theta < 1e-6)
+    coeff = 1.0 / (theta * theta);
+  else
+    coeff = 1.0 / (theta * theta) - (1 + std::cos(theta)) / (2 * theta * std::sin(theta));
+
+  Eigen::Matrix3d Jl_inv = Eigen::Matrix3d::Identity() - 0.5 * phi_x + coeff * phi_x * phi_x;
+
+  Eigen::Matrix<double, 6, 1> pose_grad;
+  pose_grad.head<3>().noalias() = Rt_inv.transpose() * twist_grad.head<3>();
+  pose_grad.tail<3>().noalias() = (Jl_inv * Rt_inv).transpose() * twist_grad.tail<3>();
+
+  jacobianTransposeProduct(pose_grad, grad);
+}
+
+
+template<int N>
+inline void fixedTransposeProduct(const KDL::Jacobian& jac, const Eigen::Matrix<double, 6, 1>& pose_grad, double grad[])
+{
+  Eigen::Map<Eigen::Matrix<double, N, 1> >(grad).noalias() = Eigen::Map<const Eigen::Matrix<double, 6, N> >(jac.data.data()).transpose() * pose_grad;
+}
+
+
+void NLOPT_IK::jacobianTransposeProduct(const Eigen::Matrix<double, 6, 1>& pose_grad, double grad[]) const
+{
+  switch (jac.columns())
+  {
+  case 6:
+    fixedTransposeProduct<6>(jac, pose_grad, grad);
+    break;
+  case 7:
+    fixedTransposeProduct<7>(jac, pose_grad, grad);
+    break;
+  default:
+    Eigen::Map<Eigen::VectorXd>(grad, jac.columns()).noalias() = jac.data.transpose() * pose_grad;
+    break;
+  }
+}
+
+
+void NLOPT_IK::sumSquaredGradient(double grad[])
+{
+  // Components zeroed by the bounds have no gradient, and as their error
+  // is zero they drop out of the sum below on their own.
+
+  Eigen::Matrix<double, 6, 1> e;
+  for (int i = 0; i < 6; i++)
+    e(i) = currentError[i];
+
+  twistGradient(2.0 * e, grad);
+}
+
+
+void NLOPT_IK::l2NormGradient(double grad[])
+{
+  Eigen::Matrix<double, 6, 1> e;
+  for (int i = 0; i < 6; i++)
+    e(i) = currentError[i];
+
+  double norm = e.norm();
+  if (norm == 0)
+  {
+    std::fill(grad, grad + jac.columns(), 0.0);
+    return;
+  }
+
+  twistGradient(e / norm, grad);
+}
+
+
+void NLOPT_IK::dqGradient(double grad[])
+{
+  // The dual quaternion error has no convenient closed form derivative, so
+  // it is differentiated numerically with respect to the 6 DOF of the tip
+  // pose (no forward kinematics involved), then mapped to the joints
+  // through the base frame Jacobian.
+
+  double jump = boost::math::tools::epsilon<float>();
+  double result = dqError(currentPose);
+
+  Eigen::Matrix<double, 6, 1> pose_grad;
+  KDL::Frame pose;
+  for (int i = 0; i < 3; i++)
+  {
+    pose = currentPose;
+    pose.p(i) += jump;
+    pose_grad(i) = (dqError(pose) - result) / jump;
+  }
+
+  KDL::Vector axis;
+  for (int i = 0; i < 3; i++)
+  {
+    axis = KDL::Vector::Zero();
+    axis(i) = 1;
+    pose = currentPose;
+    pose.M = KDL::Rotation::Rot2(axis, jump) * currentPose.M;
+    pose_grad(i + 3) = (dqError(pose) - result) / jump;
+  }
+
+  jacobianTransposeProduct(pose_grad, grad);
+}
+
+
 int NLOPT_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL::JntArray &q_out, const KDL::Twist _bounds, const KDL::JntArray& q_desired)
+{
+  restarts.reset();
+  return CartToJnt(q_init, p_in, q_out, TRAC_IK::Deadline(maxtime), _bounds, q_desired);
+}
+
+
+int NLOPT_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL::JntArray &q_out, const TRAC_IK::Deadline& deadline, const KDL::Twist _bounds, const KDL::JntArray& q_desired)
 {
   // User command to start an IK solve.  Takes in a seed
   // configuration, a Cartesian pose, and (optional) a desired
@@ -457,11 +577,9 @@ int NLOPT_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL
   // Returns -3 if a configuration could not be found within the eps
   // set up in the constructor.
 
-  boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::local_time();
-  boost::posix_time::time_duration diff;
-
   bounds = _bounds;
   q_out = q_init;
+  iter_counter = 0;
 
   if (chain.getNrOfJoints() < 2)
   {
@@ -475,7 +593,15 @@ int NLOPT_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL
     return -3;
   }
 
-  opt.set_maxtime(maxtime);
+  if (empty_search)
+    return -3;
+
+  // NLopt treats a maxtime of 0 or less as no limit at all
+  double time_left = deadline.remaining();
+  if (time_left <= 0)
+    return -3;
+
+  opt.set_maxtime(time_left);
 
 
   double minf; /* the minimum objective value, upon return */
@@ -487,7 +613,7 @@ int NLOPT_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL
     math3d::matrix3x3<double> targetRotationMatrix(targetPose.M.data);
     math3d::quaternion<double> targetQuaternion = math3d::rot_matrix_to_quaternion<double>(targetRotationMatrix);
     math3d::point3d targetTranslation(targetPose.p.data);
-    targetDQ = dual_quaternion::rigid_transformation(targetQuaternion, targetTranslation);
+    *targetDQ = dual_quaternion::rigid_transformation(targetQuaternion, targetTranslation);
   }
   // else if (TYPE == 1)
   // {
@@ -592,15 +718,12 @@ int NLOPT_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL
   if (!aborted && progress < 0)
   {
 
-    double time_left;
-    diff = boost::posix_time::microsec_clock::local_time() - start_time;
-    time_left = maxtime - diff.total_nanoseconds() / 1000000000.0;
+    time_left = deadline.remaining();
 
     while (time_left > 0 && !aborted && progress < 0)
     {
 
-      for (uint i = 0; i < x.size(); i++)
-        x[i] = fRand(artificial_lower_limits[i], artificial_upper_limits[i]);
+      restarts.sample(artificial_lower_limits.data(), artificial_upper_limits.data(), x.data());
 
       opt.set_maxtime(time_left);
 
@@ -613,8 +736,7 @@ int NLOPT_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL
       if (progress == -1) // Got NaNs
         progress = -3;
 
-      diff = boost::posix_time::microsec_clock::local_time() - start_time;
-      time_left = maxtime - diff.total_nanoseconds() / 1000000000.0;
+      time_left = deadline.remaining();
     }
   }
 
@@ -0,0 +1,157 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#include <trac_ik/racer_scheduler.hpp>
+#include <algorithm>
+
+namespace TRAC_IK
+{
+
+namespace
+{
+
+// A racer that wins at least this share of full races goes first alone
+const double FAVOURITE_SHARE = 0.75;
+
+// The other racer joins once the favourite has taken longer than it
+// takes on this share of calls, or half the timeout, whichever is less
+const double JOIN_QUANTILE = 0.9;
+const double MAX_HEAD_START = 0.5;
+
+inline unsigned int slot(SolveStats::Racer racer)
+{
+  return racer == SolveStats::KDLRacer ? 0 : 1;
+}
+
+inline SolveStats::Racer otherRacer(SolveStats::Racer racer)
+{
+  return racer == SolveStats::KDLRacer ? SolveStats::NLOPTRacer : SolveStats::KDLRacer;
+}
+
+}
+
+
+RacerScheduler::RacerScheduler()
+{
+  reset();
+}
+
+
+void RacerScheduler::reset()
+{
+  calls = 0;
+  probes = 0;
+  kdl_share = 0.5;
+  planned_hold = SolveStats::NoRacer;
+
+  for (unsigned int r = 0; r < 2; r++)
+  {
+    times[r].clear();
+    times_next[r] = 0;
+  }
+}
+
+
+void RacerScheduler::addTime(SolveStats::Racer racer, double time)
+{
+  std::vector<double>& ring = times[slot(racer)];
+  unsigned int& next = times_next[slot(racer)];
+
+  if (ring.size() < WINDOW)
+    ring.push_back(time);
+  else
+    ring[next] = time;
+  next = (next + 1) % WINDOW;
+}
+
+
+double RacerScheduler::quantile(SolveStats::Racer racer, double q)
+{
+  scratch = times[slot(racer)];
+  if (scratch.empty())
+    return 0;
+
+  std::vector<double>::iterator it = scratch.begin() + std::min<size_t>(q * scratch.size(), scratch.size() - 1);
+  std::nth_element(scratch.begin(), it, scratch.end());
+  return *it;
+}
+
+
+void RacerScheduler::plan(double maxtime, SolveStats::Racer& held_back, double& delay)
+{
+  calls++;
+  held_back = SolveStats::NoRacer;
+  delay = 0;
+
+  bool probe = probes < MIN_PROBES || calls % PROBE_INTERVAL == 0;
+  if (!probe)
+  {
+    SolveStats::Racer favourite = kdl_share >= 0.5 ? SolveStats::KDLRacer : SolveStats::NLOPTRacer;
+    double share = favourite == SolveStats::KDLRacer ? kdl_share : 1 - kdl_share;
+    if (share >= FAVOURITE_SHARE && !times[slot(favourite)].empty())
+    {
+      held_back = otherRacer(favourite);
+      delay = std::min(quantile(favourite, JOIN_QUANTILE), MAX_HEAD_START * maxtime);
+    }
+  }
+
+  planned_hold = held_back;
+}
+
+
+void RacerScheduler::update(SolveStats::Racer winner, double time_to_first_solution, double maxtime)
+{
+  if (planned_hold == SolveStats::NoRacer)
+  {
+    if (winner == SolveStats::NoRacer)
+    {
+      // Nobody solved it: both would have needed the whole timeout
+      addTime(SolveStats::KDLRacer, maxtime);
+      addTime(SolveStats::NLOPTRacer, maxtime);
+      return;
+    }
+
+    // A plain mean over the first races, then a moving average over
+    // about the last MIN_PROBES
+    probes++;
+    double alpha = 1.0 / std::min(probes, MIN_PROBES);
+    kdl_share += alpha * ((winner == SolveStats::KDLRacer ? 1.0 : 0.0) - kdl_share);
+    addTime(winner, time_to_first_solution);
+  }
+  else
+  {
+    // The favourite ran from the start, so its time is what it needs on
+    // its own, or the whole timeout if the other racer had to step in
+    SolveStats::Racer favourite = otherRacer(planned_hold);
+    addTime(favourite, winner == favourite ? time_to_first_solution : maxtime);
+  }
+}
+
+}
@@ -0,0 +1,200 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#include <trac_ik/restart_sampler.hpp>
+#include <algorithm>
+#include <limits>
+
+namespace TRAC_IK
+{
+
+RestartSampler::RestartSampler(unsigned int num_joints, RestartStrategy _strategy) :
+  n(num_joints), strategy(_strategy), offsets(num_joints), index(0),
+  history(HISTORY * num_joints), history_size(0), history_next(0), candidate(num_joints), queued_next(0), samples(0)
+{
+  // The first n primes
+  for (unsigned int p = 2; bases.size() < n; p++)
+  {
+    bool prime = true;
+    for (unsigned int i = 0; i < bases.size() && bases[i] * bases[i] <= p; i++)
+      if (p % bases[i] == 0)
+        prime = false;
+    if (prime)
+      bases.push_back(p);
+  }
+
+  unsigned int total = 0;
+  for (unsigned int j = 0; j < n; j++)
+  {
+    offsets[j] = total;
+    total += bases[j];
+  }
+  permutations.resize(total);
+
+  reset();
+}
+
+
+void RestartSampler::reset()
+{
+  history_size = 0;
+  history_next = 0;
+  queued.clear();
+  queued_next = 0;
+  samples = 0;
+
+  // Plain Halton points in the higher bases rise in lockstep for the
+  // first few dozen indices, lining up along diagonals of the joint box.
+  // Scrambling the digits of every base with a random permutation breaks
+  // that up, keeps the sequence low discrepancy, and makes every call, and
+  // every solver, visit different points.  Digit 0 maps to itself so the
+  // infinite trailing zeros stay zero.  Base 2 has nothing to permute, so
+  // a random starting index varies that joint as well.
+  index = (uint64_t)rng.uniform(0, 65536);
+  for (unsigned int j = 0; j < n; j++)
+  {
+    unsigned int* perm = &permutations[offsets[j]];
+    for (unsigned int d = 0; d < bases[j]; d++)
+      perm[d] = d;
+    for (unsigned int d = bases[j] - 1; d > 1; d--)
+      std::swap(perm[d], perm[1 + (unsigned int)rng.uniform(0, d)]);
+  }
+}
+
+
+void RestartSampler::queue(const double* x)
+{
+  queued.insert(queued.end(), x, x + n);
+}
+
+
+void RestartSampler::add(const double* x)
+{
+  std::copy(x, x + n, history.begin() + history_next * n);
+  history_next = (history_next + 1) % HISTORY;
+  if (history_size < HISTORY)
+    history_size++;
+}
+
+
+double RestartSampler::radicalInverse(uint64_t i, unsigned int base, const unsigned int* permutation)
+{
+  double inv = 1.0 / base;
+  double f = inv;
+  double r = 0;
+  while (i > 0)
+  {
+    r += f * permutation[i % base];
+    i /= base;
+    f *= inv;
+  }
+  return r;
+}
+
+
+double RestartSampler::distanceToHistory(const double* x, const double* lower, const double* upper) const
+{
+  // Squared distance to the nearest recorded seed, with every joint
+  // scaled by its sampled range
+  double nearest = std::numeric_limits<double>::max();
+  for (unsigned int h = 0; h < history_size; h++)
+  {
+    const double* y = &history[h * n];
+    double dist = 0;
+    for (unsigned int j = 0; j < n && dist < nearest; j++)
+    {
+      double range = upper[j] - lower[j];
+      double d = range > 0 ? (x[j] - y[j]) / range : 0;
+      dist += d * d;
+    }
+    if (dist < nearest)
+      nearest = dist;
+  }
+  return nearest;
+}
+
+
+void RestartSampler::sample(const double* lower, const double* upper, double* x)
+{
+  samples++;
+
+  if (queued_next < queued.size())
+  {
+    std::copy(&queued[queued_next], &queued[queued_next] + n, x);
+    queued_next += n;
+    add(x);
+    return;
+  }
+
+  switch (strategy)
+  {
+  case Halton:
+  {
+    index++;
+    for (unsigned int j = 0; j < n; j++)
+    {
+      double u = radicalInverse(index, bases[j], &permutations[offsets[j]]);
+      x[j] = lower[j] + u * (upper[j] - lower[j]);
+    }
+    break;
+  }
+
+  case Far:
+  {
+    double best = -1;
+    for (unsigned int c = 0; c < CANDIDATES; c++)
+    {
+      for (unsigned int j = 0; j < n; j++)
+        candidate[j] = rng.uniform(lower[j], upper[j]);
+
+      double dist = distanceToHistory(candidate.data(), lower, upper);
+      if (dist > best)
+      {
+        best = dist;
+        std::copy(candidate.begin(), candidate.end(), x);
+      }
+
+      // Nothing to keep away from yet
+      if (history_size == 0)
+        break;
+    }
+    break;
+  }
+
+  default:
+    for (unsigned int j = 0; j < n; j++)
+      x[j] = rng.uniform(lower[j], upper[j]);
+    break;
+  }
+
+  add(x);
+}
+
+}
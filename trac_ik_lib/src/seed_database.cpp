@@ -0,0 +1,484 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#include <trac_ik/seed_database.hpp>
+#include <trac_ik/random.hpp>
+#include <trac_ik/chain_kinematics.hpp>
+#include <ros/ros.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace TRAC_IK
+{
+
+namespace
+{
+
+const char MAGIC[8] = {'T', 'R', 'A', 'C', 'S', 'E', 'E', 'D'};
+const uint32_t VERSION = 1;
+
+// Orders order[lo, hi) into an implicit k-d tree over keys: the median
+// along the axis of largest spread goes to the middle, and each half is
+// split the same way
+void buildTree(std::vector<size_t>& order, const std::vector<double>& keys, unsigned int key_size,
+               std::vector<uint8_t>& dims, size_t lo, size_t hi)
+{
+  if (hi <= lo)
+    return;
+
+  unsigned int dim = 0;
+  double spread = -1;
+  for (unsigned int d = 0; d < key_size; d++)
+  {
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+    for (size_t i = lo; i < hi; i++)
+    {
+      min = std::min(min, keys[order[i] * key_size + d]);
+      max = std::max(max, keys[order[i] * key_size + d]);
+    }
+    if (max - min > spread)
+    {
+      spread = max - min;
+      dim = d;
+    }
+  }
+
+  size_t mid = lo + (hi - lo) / 2;
+  std::nth_element(order.begin() + lo, order.begin() + mid, order.begin() + hi, [&](size_t a, size_t b)
+  {
+    return keys[a * key_size + dim] < keys[b * key_size + dim];
+  });
+  dims[mid] = dim;
+
+  buildTree(order, keys, key_size, dims, lo, mid);
+  buildTree(order, keys, key_size, dims, mid + 1, hi);
+}
+
+
+}
+
+
+SeedDatabase::SeedDatabase() :
+  header(NULL), keys(NULL), joints(NULL), split_dims(NULL), mapping(NULL), mapping_size(0)
+{
+}
+
+
+SeedDatabase::~SeedDatabase()
+{
+  clear();
+}
+
+
+void SeedDatabase::clear()
+{
+  header = NULL;
+  keys = NULL;
+  joints = NULL;
+  split_dims = NULL;
+  buffer.clear();
+
+  if (mapping)
+    munmap(mapping, mapping_size);
+  mapping = NULL;
+  mapping_size = 0;
+}
+
+
+size_t SeedDatabase::layoutSize(uint64_t num_entries, uint32_t num_joints)
+{
+  return sizeof(Header) + num_entries * (sizeof(double) * (KEY_SIZE + num_joints) + sizeof(uint8_t));
+}
+
+
+bool SeedDatabase::attach(const char* data, size_t size)
+{
+  if (size < sizeof(Header))
+    return false;
+
+  const Header* h = reinterpret_cast<const Header*>(data);
+  if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 || h->version != VERSION || h->num_joints == 0)
+    return false;
+
+  // Bound the header values by the file size first, so that layoutSize()
+  // cannot overflow
+  size_t body = size - sizeof(Header);
+  if (h->num_joints > body / sizeof(double))
+    return false;
+  size_t entry_size = sizeof(double) * (KEY_SIZE + h->num_joints) + sizeof(uint8_t);
+  if (h->num_entries > body / entry_size)
+    return false;
+
+  if (size != layoutSize(h->num_entries, h->num_joints))
+    return false;
+
+  // search() indexes keys and its offsets by these
+  const uint8_t* dims = reinterpret_cast<const uint8_t*>(data + size - h->num_entries);
+  for (size_t i = 0; i < h->num_entries; i++)
+    if (dims[i] >= KEY_SIZE)
+      return false;
+
+  header = h;
+  keys = reinterpret_cast<const double*>(data + sizeof(Header));
+  joints = keys + header->num_entries * KEY_SIZE;
+  split_dims = reinterpret_cast<const uint8_t*>(joints + header->num_entries * header->num_joints);
+  return true;
+}
+
+
+uint64_t SeedDatabase::chainHash(const KDL::Chain& chain)
+{
+  // FNV-1a over the joint types and the segment frames at 0 and 1, which
+  // between them pin down each joint's axis and offset
+  uint64_t hash = 14695981039346656037ULL;
+  auto mix = [&hash](const void* data, size_t size)
+  {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+  };
+
+  unsigned int num_joints = chain.getNrOfJoints();
+  mix(&num_joints, sizeof(num_joints));
+
+  for (unsigned int i = 0; i < chain.getNrOfSegments(); i++)
+  {
+    const KDL::Segment& segment = chain.getSegment(i);
+    int type = segment.getJoint().getType();
+    mix(&type, sizeof(type));
+
+    for (int q = 0; q < 2; q++)
+    {
+      // Rounded to 1e-9 first: a chain rebuilt from its parts (as
+      // ChainCache does) can differ from the original in the last bit
+      KDL::Frame pose = segment.pose(q);
+      int64_t values[12];
+      for (int k = 0; k < 3; k++)
+        values[k] = llround(pose.p.data[k] * 1e9);
+      for (int k = 0; k < 9; k++)
+        values[3 + k] = llround(pose.M.data[k] * 1e9);
+      mix(values, sizeof(values));
+    }
+  }
+
+  return hash;
+}
+
+
+bool SeedDatabase::matches(const KDL::Chain& chain) const
+{
+  return header && header->num_joints == chain.getNrOfJoints() && header->chain_hash == chainHash(chain);
+}
+
+
+void SeedDatabase::makeKey(const KDL::Frame& pose, double scale, double key[]) const
+{
+  double x, y, z, w;
+  pose.M.GetQuaternion(x, y, z, w);
+
+  // q and -q are the same rotation; store the one with w >= 0
+  if (w < 0)
+  {
+    x = -x;
+    y = -y;
+    z = -z;
+    w = -w;
+  }
+
+  key[0] = pose.p.x();
+  key[1] = pose.p.y();
+  key[2] = pose.p.z();
+  key[3] = scale * x;
+  key[4] = scale * y;
+  key[5] = scale * z;
+  key[6] = scale * w;
+}
+
+
+bool SeedDatabase::build(const KDL::Chain& chain, const KDL::JntArray& q_min, const KDL::JntArray& q_max,
+                         unsigned int num_samples, uint64_t seed, double rotation_scale)
+{
+  clear();
+
+  unsigned int n = chain.getNrOfJoints();
+  if (n == 0 || q_min.data.size() != n || q_max.data.size() != n || num_samples == 0)
+  {
+    ROS_ERROR("Seed database needs a chain with joints, limits for every joint and at least one sample");
+    return false;
+  }
+
+  if (rotation_scale <= 0)
+  {
+    // The chain's reach: a quaternion distance of 1 (a rotation of about
+    // 120 degrees) then weighs as much as moving across the workspace
+    rotation_scale = 0;
+    for (unsigned int i = 0; i < chain.getNrOfSegments(); i++)
+      rotation_scale += chain.getSegment(i).getFrameToTip().p.Norm();
+    rotation_scale = std::max(rotation_scale, 1e-3);
+  }
+
+  std::vector<double> lower(n), upper(n);
+  for (unsigned int j = 0; j < n; j++)
+  {
+    lower[j] = q_min(j);
+    upper[j] = q_max(j);
+    if (q_max(j) >= std::numeric_limits<float>::max() && q_min(j) <= std::numeric_limits<float>::lowest())
+    {
+      lower[j] = -M_PI;
+      upper[j] = M_PI;
+    }
+  }
+
+  KDL::ChainKinematics kinematics(chain);
+  Random rng(seed);
+
+  std::vector<double> all_keys(size_t(num_samples) * KEY_SIZE);
+  std::vector<double> all_joints(size_t(num_samples) * n);
+  std::vector<KDL::Frame> poses(num_samples);
+
+  for (size_t i = 0; i < num_samples; i++)
+    for (unsigned int j = 0; j < n; j++)
+      all_joints[i * n + j] = rng.uniform(lower[j], upper[j]);
+
+  kinematics.JntToCartBatch(all_joints.data(), num_samples, poses.data());
+  for (size_t i = 0; i < num_samples; i++)
+    makeKey(poses[i], rotation_scale, &all_keys[i * KEY_SIZE]);
+
+  std::vector<size_t> order(num_samples);
+  for (size_t i = 0; i < num_samples; i++)
+    order[i] = i;
+  std::vector<uint8_t> dims(num_samples);
+  buildTree(order, all_keys, KEY_SIZE, dims, 0, num_samples);
+
+  buffer.resize(layoutSize(num_samples, n));
+
+  Header h;
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  h.version = VERSION;
+  h.num_joints = n;
+  h.num_entries = num_samples;
+  h.chain_hash = chainHash(chain);
+  h.rotation_scale = rotation_scale;
+  memcpy(&buffer[0], &h, sizeof(h));
+
+  double* out_keys = reinterpret_cast<double*>(&buffer[sizeof(Header)]);
+  double* out_joints = out_keys + size_t(num_samples) * KEY_SIZE;
+  uint8_t* out_dims = reinterpret_cast<uint8_t*>(out_joints + size_t(num_samples) * n);
+
+  for (size_t i = 0; i < num_samples; i++)
+  {
+    std::copy(&all_keys[order[i] * KEY_SIZE], &all_keys[order[i] * KEY_SIZE] + KEY_SIZE, out_keys + i * KEY_SIZE);
+    std::copy(&all_joints[order[i] * n], &all_joints[order[i] * n] + n, out_joints + i * n);
+  }
+  std::copy(dims.begin(), dims.end(), out_dims);
+
+  return attach(&buffer[0], buffer.size());
+}
+
+
+bool SeedDatabase::save(const std::string& path) const
+{
+  if (!header)
+    return false;
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file)
+  {
+    ROS_ERROR("Cannot write seed database %s", path.c_str());
+    return false;
+  }
+
+  size_t size = layoutSize(header->num_entries, header->num_joints);
+  bool ok = fwrite(header, 1, size, file) == size;
+  ok = fclose(file) == 0 && ok;
+
+  if (!ok)
+    ROS_ERROR("Failed writing seed database %s", path.c_str());
+  return ok;
+}
+
+
+bool SeedDatabase::load(const std::string& path)
+{
+  clear();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    ROS_ERROR("Cannot open seed database %s", path.c_str());
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header))
+  {
+    ROS_ERROR("Seed database %s is not valid", path.c_str());
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+  {
+    ROS_ERROR("Cannot map seed database %s", path.c_str());
+    return false;
+  }
+
+  mapping = data;
+  mapping_size = info.st_size;
+
+  if (!attach(static_cast<const char*>(data), mapping_size))
+  {
+    ROS_ERROR("Seed database %s is not valid", path.c_str());
+    clear();
+    return false;
+  }
+
+  return true;
+}
+
+
+void SeedDatabase::search(size_t lo, size_t hi, const double key[], unsigned int k, std::vector<Neighbor>& heap,
+                          double offsets[], double bound) const
+{
+  // bound is the squared distance from key to the box of this subtree,
+  // built up from the per axis offsets to the splits above it (Arya and
+  // Mount's incremental distance)
+  if (hi <= lo)
+    return;
+
+  size_t mid = lo + (hi - lo) / 2;
+  const double* node = keys + mid * KEY_SIZE;
+
+  double dist = 0;
+  for (unsigned int d = 0; d < KEY_SIZE; d++)
+    dist += (key[d] - node[d]) * (key[d] - node[d]);
+
+  if (heap.size() < k || dist < heap.front().dist)
+  {
+    // The same entry may come up again in the search for -q
+    bool seen = false;
+    for (size_t i = 0; i < heap.size() && !seen; i++)
+      seen = heap[i].index == mid;
+
+    if (!seen)
+    {
+      if (heap.size() == k)
+      {
+        std::pop_heap(heap.begin(), heap.end());
+        heap.pop_back();
+      }
+      Neighbor neighbor = {dist, mid};
+      heap.push_back(neighbor);
+      std::push_heap(heap.begin(), heap.end());
+    }
+  }
+
+  unsigned int dim = split_dims[mid];
+  double diff = key[dim] - node[dim];
+
+  size_t far_lo = lo, far_hi = mid;
+  if (diff < 0)
+  {
+    search(lo, mid, key, k, heap, offsets, bound);
+    far_lo = mid + 1;
+    far_hi = hi;
+  }
+  else
+    search(mid + 1, hi, key, k, heap, offsets, bound);
+
+  // The far side lies at least diff away along dim, on top of the offsets
+  // along the other axes
+  double old_offset = offsets[dim];
+  bound += diff * diff - old_offset * old_offset;
+  if (heap.size() == k && bound >= heap.front().dist)
+    return;
+
+  offsets[dim] = diff;
+  search(far_lo, far_hi, key, k, heap, offsets, bound);
+  offsets[dim] = old_offset;
+}
+
+
+void SeedDatabase::nearest(const KDL::Frame& pose, unsigned int k, std::vector<KDL::JntArray>& seeds) const
+{
+  if (!header || k == 0)
+  {
+    seeds.clear();
+    return;
+  }
+
+  k = std::min<size_t>(k, header->num_entries);
+
+  double key[KEY_SIZE];
+  makeKey(pose, header->rotation_scale, key);
+
+  std::vector<Neighbor> heap;
+  heap.reserve(k);
+  double offsets[KEY_SIZE] = {0};
+  search(0, header->num_entries, key, k, heap, offsets, 0);
+
+  // Near w = 0 the stored sign may differ from the target's, so look for
+  // the same rotation as -q too.  Every stored w is >= 0, so with the
+  // target's w >= 0 negated, no entry is closer than that w.
+  if (heap.size() < k || key[6] * key[6] < heap.front().dist)
+  {
+    for (unsigned int d = 3; d < KEY_SIZE; d++)
+      key[d] = -key[d];
+    std::fill(offsets, offsets + KEY_SIZE, 0.0);
+    search(0, header->num_entries, key, k, heap, offsets, 0);
+  }
+
+  std::sort_heap(heap.begin(), heap.end());
+
+  seeds.resize(heap.size());
+  for (size_t i = 0; i < heap.size(); i++)
+  {
+    seeds[i].resize(header->num_joints);
+    const double* q = joints + heap[i].index * header->num_joints;
+    for (unsigned int j = 0; j < header->num_joints; j++)
+      seeds[i](j) = q[j];
+  }
+}
+
+}
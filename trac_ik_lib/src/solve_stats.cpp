@@ -0,0 +1,239 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#include <trac_ik/solve_stats.hpp>
+#include <cstdio>
+
+namespace TRAC_IK
+{
+
+namespace
+{
+
+inline void add(std::atomic<uint64_t>& counter, uint64_t value)
+{
+  counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+inline uint64_t get(const std::atomic<uint64_t>& counter)
+{
+  return counter.load(std::memory_order_relaxed);
+}
+
+inline uint64_t nonNegative(double value)
+{
+  return value > 0 ? (uint64_t)value : 0;
+}
+
+void copy(const std::atomic<uint64_t> counts[], SolveStatsCollector::Histogram& histogram)
+{
+  for (unsigned int i = 0; i < SolveStatsCollector::BUCKETS; i++)
+    histogram.counts[i] = get(counts[i]);
+}
+
+void appendCounter(std::string& out, const std::string& name, const char* help, double value)
+{
+  char line[128];
+  out += "# HELP " + name + " " + help + "\n";
+  out += "# TYPE " + name + " counter\n";
+  snprintf(line, sizeof(line), " %.17g\n", value);
+  out += name + line;
+}
+
+// Cumulative buckets, as Prometheus expects.  Bucket i holds values
+// below 2^i: microseconds, converted to seconds, or whole counts, whose
+// inclusive bound is then 2^i - 1.
+void appendHistogram(std::string& out, const std::string& name, const char* help,
+                     const SolveStatsCollector::Histogram& histogram, double sum, bool microseconds)
+{
+  char line[128];
+  out += "# HELP " + name + " " + help + "\n";
+  out += "# TYPE " + name + " histogram\n";
+
+  uint64_t count = 0;
+  for (unsigned int i = 0; i + 1 < SolveStatsCollector::BUCKETS; i++)
+  {
+    count += histogram.counts[i];
+    double bound = microseconds ? (1ULL << i) * 1e-6 : (1ULL << i) - 1;
+    snprintf(line, sizeof(line), "_bucket{le=\"%g\"} %llu\n", bound, (unsigned long long)count);
+    out += name + line;
+  }
+  count += histogram.counts[SolveStatsCollector::BUCKETS - 1];
+  snprintf(line, sizeof(line), "_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)count);
+  out += name + line;
+  snprintf(line, sizeof(line), "_sum %.17g\n", sum);
+  out += name + line;
+  snprintf(line, sizeof(line), "_count %llu\n", (unsigned long long)count);
+  out += name + line;
+}
+
+}
+
+
+void SolveStats::clear()
+{
+  winner = NoRacer;
+  winning_racer = -1;
+  held_back = NoRacer;
+  kdl_iterations = 0;
+  kdl_restarts = 0;
+  nlopt_evaluations = 0;
+  nlopt_restarts = 0;
+  duplicates_rejected = 0;
+  solutions = 0;
+  time_to_first_solution = -1;
+  merge_time = 0;
+  total_time = 0;
+}
+
+
+SolveStatsCollector::SolveStatsCollector()
+{
+  reset();
+}
+
+
+unsigned int SolveStatsCollector::bucket(uint64_t value)
+{
+  unsigned int width = value ? 64 - __builtin_clzll(value) : 0;
+  return width < BUCKETS ? width : BUCKETS - 1;
+}
+
+
+void SolveStatsCollector::record(const SolveStats& stats)
+{
+  add(calls, 1);
+  if (stats.solutions > 0)
+    add(solved, 1);
+  if (stats.winner == SolveStats::KDLRacer)
+    add(kdl_wins, 1);
+  else if (stats.winner == SolveStats::NLOPTRacer)
+    add(nlopt_wins, 1);
+  if (stats.held_back != SolveStats::NoRacer)
+    add(head_starts, 1);
+
+  add(kdl_iterations, stats.kdl_iterations);
+  add(kdl_restarts, stats.kdl_restarts);
+  add(nlopt_evaluations, stats.nlopt_evaluations);
+  add(nlopt_restarts, stats.nlopt_restarts);
+  add(duplicates_rejected, stats.duplicates_rejected);
+  add(total_time_ns, nonNegative(stats.total_time * 1e9));
+  add(merge_time_ns, nonNegative(stats.merge_time * 1e9));
+
+  add(latency_us[bucket(nonNegative(stats.total_time * 1e6))], 1);
+  if (stats.time_to_first_solution >= 0)
+  {
+    add(first_solution_time_ns, nonNegative(stats.time_to_first_solution * 1e9));
+    add(first_solution_us[bucket(nonNegative(stats.time_to_first_solution * 1e6))], 1);
+  }
+  add(kdl_iterations_per_call[bucket(stats.kdl_iterations)], 1);
+  add(nlopt_evaluations_per_call[bucket(stats.nlopt_evaluations)], 1);
+}
+
+
+SolveStatsCollector::Snapshot SolveStatsCollector::snapshot() const
+{
+  Snapshot snap;
+  snap.calls = get(calls);
+  snap.solved = get(solved);
+  snap.kdl_wins = get(kdl_wins);
+  snap.nlopt_wins = get(nlopt_wins);
+  snap.head_starts = get(head_starts);
+  snap.kdl_iterations = get(kdl_iterations);
+  snap.kdl_restarts = get(kdl_restarts);
+  snap.nlopt_evaluations = get(nlopt_evaluations);
+  snap.nlopt_restarts = get(nlopt_restarts);
+  snap.duplicates_rejected = get(duplicates_rejected);
+  snap.total_time = get(total_time_ns) * 1e-9;
+  snap.merge_time = get(merge_time_ns) * 1e-9;
+  snap.first_solution_time = get(first_solution_time_ns) * 1e-9;
+
+  copy(latency_us, snap.latency_us);
+  copy(first_solution_us, snap.first_solution_us);
+  copy(kdl_iterations_per_call, snap.kdl_iterations_per_call);
+  copy(nlopt_evaluations_per_call, snap.nlopt_evaluations_per_call);
+  return snap;
+}
+
+
+void SolveStatsCollector::reset()
+{
+  calls = 0;
+  solved = 0;
+  kdl_wins = 0;
+  nlopt_wins = 0;
+  head_starts = 0;
+  kdl_iterations = 0;
+  kdl_restarts = 0;
+  nlopt_evaluations = 0;
+  nlopt_restarts = 0;
+  duplicates_rejected = 0;
+  total_time_ns = 0;
+  merge_time_ns = 0;
+  first_solution_time_ns = 0;
+
+  for (unsigned int i = 0; i < BUCKETS; i++)
+  {
+    latency_us[i] = 0;
+    first_solution_us[i] = 0;
+    kdl_iterations_per_call[i] = 0;
+    nlopt_evaluations_per_call[i] = 0;
+  }
+}
+
+
+std::string SolveStatsCollector::format(const std::string& prefix) const
+{
+  Snapshot snap = snapshot();
+  std::string out;
+
+  appendCounter(out, prefix + "_calls_total", "IK calls", snap.calls);
+  appendCounter(out, prefix + "_solved_total", "IK calls that found a solution", snap.solved);
+  appendCounter(out, prefix + "_kdl_wins_total", "Calls whose first solution came from the KDL racer", snap.kdl_wins);
+  appendCounter(out, prefix + "_nlopt_wins_total", "Calls whose first solution came from the NLopt racer", snap.nlopt_wins);
+  appendCounter(out, prefix + "_head_starts_total", "Calls where one racer started alone", snap.head_starts);
+  appendCounter(out, prefix + "_kdl_iterations_total", "Iterations of the KDL racer", snap.kdl_iterations);
+  appendCounter(out, prefix + "_kdl_restarts_total", "Random restarts of the KDL racer", snap.kdl_restarts);
+  appendCounter(out, prefix + "_nlopt_evaluations_total", "Objective evaluations of the NLopt racer", snap.nlopt_evaluations);
+  appendCounter(out, prefix + "_nlopt_restarts_total", "Random restarts of the NLopt racer", snap.nlopt_restarts);
+  appendCounter(out, prefix + "_duplicates_rejected_total", "Solutions dropped as already found", snap.duplicates_rejected);
+  appendCounter(out, prefix + "_merge_seconds_total", "Time spent merging the racers' solutions", snap.merge_time);
+
+  appendHistogram(out, prefix + "_latency_seconds", "Duration of IK calls", snap.latency_us, snap.total_time, true);
+  appendHistogram(out, prefix + "_first_solution_seconds", "Time to the first solution of IK calls that found one",
+                  snap.first_solution_us, snap.first_solution_time, true);
+  appendHistogram(out, prefix + "_kdl_iterations", "KDL racer iterations per IK call",
+                  snap.kdl_iterations_per_call, snap.kdl_iterations, false);
+  appendHistogram(out, prefix + "_nlopt_evaluations", "NLopt racer objective evaluations per IK call",
+                  snap.nlopt_evaluations_per_call, snap.nlopt_evaluations, false);
+  return out;
+}
+
+}
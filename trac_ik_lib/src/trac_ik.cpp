@@ -30,12 +30,12 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 
 
 #include <trac_ik/trac_ik.hpp>
-#include <boost/date_time.hpp>
+#include <trac_ik/chain_builder.hpp>
+#include <trac_ik/chain_cache.hpp>
 #include <Eigen/Geometry>
 #include <ros/ros.h>
+#include <atomic>
 #include <limits>
-#include <kdl_parser/kdl_parser.hpp>
-#include <urdf/model.h>
 
 namespace TRAC_IK
 {
@@ -44,12 +44,21 @@ TRAC_IK::TRAC_IK(const std::string& base_link, const std::string& tip_link, cons
   initialized(false),
   eps(_eps),
   maxtime(_maxtime),
-  solvetype(_type)
+  solvetype(_type),
+  winner(SolveStats::NoRacer),
+  winning_racer(-1),
+  first_solution_time(-1),
+  collect_stats(false),
+  racer_selection(AlwaysRace),
+  held_back(SolveStats::NoRacer),
+  shared_pool(false),
+  rng_seed(Random::DEFAULT_SEED),
+  restart_strategy(Uniform),
+  seed_db_k(0)
 {
 
   ros::NodeHandle node_handle("~");
 
-  urdf::Model robot_model;
   std::string xml_string;
 
   std::string urdf_xml, full_urdf_xml;
@@ -64,67 +73,17 @@ TRAC_IK::TRAC_IK(const std::string& base_link, const std::string& tip_link, cons
   }
 
   node_handle.param(full_urdf_xml, xml_string, std::string());
-  robot_model.initString(xml_string);
 
-  ROS_DEBUG_STREAM_NAMED("trac_ik", "Reading joints and links from URDF");
+  std::string cache_dir;
+  node_handle.param("chain_cache_dir", cache_dir, ChainCache::defaultDirectory());
+  ChainCache cache(cache_dir);
 
-  KDL::Tree tree;
-
-  if (!kdl_parser::treeFromUrdfModel(robot_model, tree))
-    ROS_FATAL("Failed to extract kdl tree from xml robot description");
-
-  if (!tree.getChain(base_link, tip_link, chain))
-    ROS_FATAL("Couldn't find chain %s to %s", base_link.c_str(), tip_link.c_str());
-
-  std::vector<KDL::Segment> chain_segs = chain.segments;
-
-  urdf::JointConstSharedPtr joint;
-
-  std::vector<double> l_bounds, u_bounds;
-
-  lb.resize(chain.getNrOfJoints());
-  ub.resize(chain.getNrOfJoints());
-
-  uint joint_num = 0;
-  for (unsigned int i = 0; i < chain_segs.size(); ++i)
-  {
-    joint = robot_model.getJoint(chain_segs[i].getJoint().getName());
-    if (joint->type != urdf::Joint::UNKNOWN && joint->type != urdf::Joint::FIXED)
-    {
-      joint_num++;
-      float lower, upper;
-      int hasLimits;
-      if (joint->type != urdf::Joint::CONTINUOUS)
-      {
-        if (joint->safety)
-        {
-          lower = std::max(joint->limits->lower, joint->safety->soft_lower_limit);
-          upper = std::min(joint->limits->upper, joint->safety->soft_upper_limit);
-        }
-        else
-        {
-          lower = joint->limits->lower;
-          upper = joint->limits->upper;
-        }
-        hasLimits = 1;
-      }
-      else
-      {
-        hasLimits = 0;
-      }
-      if (hasLimits)
-      {
-        lb(joint_num - 1) = lower;
-        ub(joint_num - 1) = upper;
-      }
-      else
-      {
-        lb(joint_num - 1) = std::numeric_limits<float>::lowest();
-        ub(joint_num - 1) = std::numeric_limits<float>::max();
-      }
-      ROS_DEBUG_STREAM_NAMED("trac_ik", "IK Using joint " << joint->name << " " << lb(joint_num - 1) << " " << ub(joint_num - 1));
-    }
-  }
+  // On failure the builder logs why and leaves the chain empty
+  ChainBuilder builder;
+  builder.build(xml_string, base_link, tip_link, &cache);
+  chain = builder.getChain();
+  lb = builder.getLowerLimits();
+  ub = builder.getUpperLimits();
 
   initialize();
 }
@@ -137,7 +96,17 @@ TRAC_IK::TRAC_IK(const KDL::Chain& _chain, const KDL::JntArray& _q_min, const KD
   ub(_q_max),
   eps(_eps),
   maxtime(_maxtime),
-  solvetype(_type)
+  solvetype(_type),
+  winner(SolveStats::NoRacer),
+  winning_racer(-1),
+  first_solution_time(-1),
+  collect_stats(false),
+  racer_selection(AlwaysRace),
+  held_back(SolveStats::NoRacer),
+  shared_pool(false),
+  rng_seed(Random::DEFAULT_SEED),
+  restart_strategy(Uniform),
+  seed_db_k(0)
 {
   initialize();
 }
@@ -149,8 +118,9 @@ void TRAC_IK::initialize()
   assert(chain.getNrOfJoints() == ub.data.size());
 
   jacsolver.reset(new KDL::ChainJntToJacSolver(chain));
-  nl_solver.reset(new NLOPT_IK::NLOPT_IK(chain, lb, ub, maxtime, eps, NLOPT_IK::SumSq));
-  iksolver.reset(new KDL::ChainIkSolverPos_TL(chain, lb, ub, maxtime, eps, true, true));
+  if (portfolio.empty())
+    portfolio = makePortfolio(1, 1);
+  buildRacers();
 
   for (uint i = 0; i < chain.segments.size(); i++)
   {
@@ -172,14 +142,142 @@ void TRAC_IK::initialize()
   initialized = true;
 }
 
-bool TRAC_IK::unique_solution(const KDL::JntArray& sol)
+void TRAC_IK::buildRacers()
 {
+  racers.clear();
 
-  for (uint i = 0; i < solutions.size(); i++)
-    if (myEqual(sol, solutions[i]))
+  bool first_kdl = true, first_nlopt = true;
+  for (size_t r = 0; r < portfolio.size(); r++)
+  {
+    std::unique_ptr<Racer> racer(new Racer());
+    racer->config = portfolio[r];
+    if (portfolio[r].kind == SolveStats::KDLRacer)
+    {
+      racer->kdl.reset(new KDL::ChainIkSolverPos_TL(chain, lb, ub, maxtime, eps, true, true));
+      racer->kdl->setDamping(portfolio[r].damping);
+      racer->kdl->setStepType(portfolio[r].step_type);
+      racer->first_of_kind = first_kdl;
+      first_kdl = false;
+    }
+    else
+    {
+      racer->nlopt.reset(new NLOPT_IK::NLOPT_IK(chain, lb, ub, maxtime, eps, portfolio[r].opt_type));
+      racer->first_of_kind = first_nlopt;
+      first_nlopt = false;
+    }
+    racer->clear();
+    racers.push_back(std::move(racer));
+  }
+
+  setSeed(rng_seed);
+  setRestartStrategy(restart_strategy);
+}
+
+
+std::vector<RacerConfig> TRAC_IK::makePortfolio(unsigned int kdl_racers, unsigned int nlopt_racers)
+{
+  static const RacerConfig kdl_configs[] =
+  {
+    RacerConfig(SolveStats::KDLRacer, 0),
+    RacerConfig(SolveStats::KDLRacer, 0, NLOPT_IK::SumSq, KDL::ChainIkSolverPos_TL::LevenbergMarquardt),
+    RacerConfig(SolveStats::KDLRacer, 0.01),
+    RacerConfig(SolveStats::KDLRacer, 0.03)
+  };
+  static const NLOPT_IK::OptType opt_types[] = { NLOPT_IK::SumSq, NLOPT_IK::L2, NLOPT_IK::DualQuat };
+
+  std::vector<RacerConfig> result;
+  for (unsigned int i = 0; i < kdl_racers; i++)
+    result.push_back(kdl_configs[i % 4]);
+  for (unsigned int i = 0; i < nlopt_racers; i++)
+    result.push_back(RacerConfig(SolveStats::NLOPTRacer, 0, opt_types[i % 3]));
+  return result;
+}
+
+
+bool TRAC_IK::setPortfolio(const std::vector<RacerConfig>& _portfolio)
+{
+  if (_portfolio.empty())
+  {
+    ROS_ERROR("TRAC-IK needs at least one racer");
+    return false;
+  }
+
+  for (size_t r = 0; r < _portfolio.size(); r++)
+    if (_portfolio[r].kind != SolveStats::KDLRacer && _portfolio[r].kind != SolveStats::NLOPTRacer)
+    {
+      ROS_ERROR("TRAC-IK racer %d is neither a KDL nor an NLOPT racer", (int)r);
       return false;
+    }
+
+  portfolio = _portfolio;
+  if (initialized)
+    buildRacers();
+  batch_solvers.clear();
   return true;
+}
+
+
+bool TRAC_IK::setPortfolio(unsigned int kdl_racers, unsigned int nlopt_racers)
+{
+  return setPortfolio(makePortfolio(kdl_racers, nlopt_racers));
+}
+
+
+void TRAC_IK::Racer::clear()
+{
+  found.clear();
+  work = 0;
+  restarts = 0;
+  duplicates = 0;
+  started = false;
+  if (kdl)
+    kdl->reset();
+  else
+    nlopt->reset();
+}
 
+
+void TRAC_IK::Racer::abort()
+{
+  if (kdl)
+    kdl->abort();
+  else
+    nlopt->abort();
+}
+
+
+void TRAC_IK::SolutionSet::clear()
+{
+  solutions.clear();
+  errors.clear();
+  buckets.clear();
+}
+
+long TRAC_IK::SolutionSet::bucket(const KDL::JntArray& sol)
+{
+  return (long)std::floor(sol.data.sum() / (sol.data.size() * 1e-4));
+}
+
+bool TRAC_IK::SolutionSet::contains(const KDL::JntArray& sol) const
+{
+  long key = bucket(sol);
+
+  for (long k = key - 1; k <= key + 1; k++)
+  {
+    auto range = buckets.equal_range(k);
+    for (auto it = range.first; it != range.second; ++it)
+      if (myEqual(sol, solutions[it->second]))
+        return true;
+  }
+
+  return false;
+}
+
+void TRAC_IK::SolutionSet::add(const KDL::JntArray& sol, double err)
+{
+  buckets.insert(std::make_pair(bucket(sol), solutions.size()));
+  solutions.push_back(sol);
+  errors.push_back(err);
 }
 
 inline void normalizeAngle(double& val, const double& min, const double& max)
@@ -223,30 +321,72 @@ inline void normalizeAngle(double& val, const double& target)
 }
 
 
-template<typename T1, typename T2>
-bool TRAC_IK::runSolver(T1& solver, T2& other_solver,
-                        const KDL::JntArray &q_init,
-                        const KDL::Frame &p_in)
+// The unit of work each racer reports in SolveStats
+inline long solverWork(const KDL::ChainIkSolverPos_TL& solver)
 {
-  KDL::JntArray q_out;
+  return solver.getIterations();
+}
 
-  double fulltime = maxtime;
-  KDL::JntArray seed = q_init;
+inline long solverWork(const NLOPT_IK::NLOPT_IK& solver)
+{
+  return solver.getEvaluations();
+}
 
-  boost::posix_time::time_duration timediff;
-  double time_left;
 
-  while (true)
-  {
-    timediff = boost::posix_time::microsec_clock::local_time() - start_time;
-    time_left = fulltime - timediff.total_nanoseconds() / 1000000000.0;
+template<typename T>
+bool TRAC_IK::runSolver(T& solver,
+                        const KDL::JntArray &q_init,
+                        const KDL::Frame &p_in,
+                        size_t index,
+                        const Deadline& stop)
+{
+  Racer& racer = *racers[index];
 
-    if (time_left <= 0)
-      break;
+  KDL::JntArray q_out;
+  KDL::JntArray seed = q_init;
+  if (index == 0 && !db_seeds.empty())
+    seed = db_seeds[0];
+
+  // Restarts are drawn from this box, and from the solver's own sampler
+  // so that each racer only touches its own state
+  KDL::JntArray lower(seed.data.size()), upper(seed.data.size());
+  for (unsigned int j = 0; j < seed.data.size(); j++)
+    if (search_types[j] == KDL::BasicJointType::Continuous)
+    {
+      lower(j) = q_init(j) - 2 * M_PI;
+      upper(j) = q_init(j) + 2 * M_PI;
+    }
+    else
+    {
+      lower(j) = search_lb(j);
+      upper(j) = search_ub(j);
+    }
 
-    solver.setMaxtime(time_left);
+  if (racer.started)
+    solver.restarts.sample(lower.data.data(), upper.data.data(), seed.data.data());
+  else
+  {
+    solver.restarts.reset();
+    solver.restarts.add(seed.data.data());
+
+    // The racers take turns on the stored neighbours of p_in, the first
+    // racer having already taken the nearest one
+    size_t n = racers.size();
+    for (size_t i = n - index; i < db_seeds.size(); i += n)
+      solver.restarts.queue(db_seeds[i].data.data());
+
+    // Racers of a kind already represented would only repeat the first
+    // one's descent from q_init, so they start from their first restart
+    // instead
+    if (!racer.first_of_kind)
+      solver.restarts.sample(lower.data.data(), upper.data.data(), seed.data.data());
+  }
 
-    int RC = solver.CartToJnt(seed, p_in, q_out, bounds);
+  while (!stop.expired())
+  {
+    int RC = solver.CartToJnt(seed, p_in, q_out, stop, bounds);
+    racer.started = true;
+    racer.work += solverWork(solver);
     if (RC >= 0)
     {
       switch (solvetype)
@@ -259,13 +399,8 @@ bool TRAC_IK::runSolver(T1& solver, T2& other_solver,
         normalize_seed(q_init, q_out);
         break;
       }
-      mtx_.lock();
-      if (unique_solution(q_out))
+      if (!racer.found.contains(q_out))
       {
-        solutions.push_back(q_out);
-        uint curr_size = solutions.size();
-        errors.resize(curr_size);
-        mtx_.unlock();
         double err, penalty;
         switch (solvetype)
         {
@@ -281,24 +416,32 @@ bool TRAC_IK::runSolver(T1& solver, T2& other_solver,
           err = TRAC_IK::JointErr(q_init, q_out);
           break;
         }
-        mtx_.lock();
-        errors[curr_size - 1] = std::make_pair(err, curr_size - 1);
+        racer.found.add(q_out, err);
+        if (!any_solution.exchange(true))
+        {
+          winner = racer.config.kind;
+          winning_racer = index;
+          if (collect_stats)
+            first_solution_time = maxtime - deadline.remaining();
+        }
       }
-      mtx_.unlock();
+      else
+        racer.duplicates++;
     }
 
-    if (!solutions.empty() && solvetype == Speed)
+    if (any_solution && solvetype == Speed)
       break;
 
-    for (unsigned int j = 0; j < seed.data.size(); j++)
-      if (types[j] == KDL::BasicJointType::Continuous)
-        seed(j) = fRand(q_init(j) - 2 * M_PI, q_init(j) + 2 * M_PI);
-      else
-        seed(j) = fRand(lb(j), ub(j));
+    solver.restarts.sample(lower.data.data(), upper.data.data(), seed.data.data());
   }
-  other_solver.abort();
 
-  solver.setMaxtime(fulltime);
+  // A favourite whose head start ran out leaves the others running, as
+  // it will carry on itself
+  if (any_solution || stop.time() == deadline.time())
+    for (size_t r = 0; r < racers.size(); r++)
+      if (r != index)
+        racers[r]->abort();
+  racer.restarts = solver.restarts.getSampleCount();
 
   return true;
 }
@@ -311,10 +454,10 @@ void TRAC_IK::normalize_seed(const KDL::JntArray& seed, KDL::JntArray& solution)
 
   bool improved = false;
 
-  for (uint i = 0; i < lb.data.size(); i++)
+  for (uint i = 0; i < search_lb.data.size(); i++)
   {
 
-    if (types[i] == KDL::BasicJointType::TransJoint)
+    if (search_types[i] == KDL::BasicJointType::TransJoint)
       continue;
 
     double target = seed(i);
@@ -322,13 +465,13 @@ void TRAC_IK::normalize_seed(const KDL::JntArray& seed, KDL::JntArray& solution)
 
     normalizeAngle(val, target);
 
-    if (types[i] == KDL::BasicJointType::Continuous)
+    if (search_types[i] == KDL::BasicJointType::Continuous)
     {
       solution(i) = val;
       continue;
     }
 
-    normalizeAngle(val, lb(i), ub(i));
+    normalizeAngle(val, search_lb(i), search_ub(i));
 
     solution(i) = val;
   }
@@ -341,28 +484,28 @@ void TRAC_IK::normalize_limits(const KDL::JntArray& seed, KDL::JntArray& solutio
 
   bool improved = false;
 
-  for (uint i = 0; i < lb.data.size(); i++)
+  for (uint i = 0; i < search_lb.data.size(); i++)
   {
 
-    if (types[i] == KDL::BasicJointType::TransJoint)
+    if (search_types[i] == KDL::BasicJointType::TransJoint)
       continue;
 
     double target = seed(i);
 
-    if (types[i] == KDL::BasicJointType::RotJoint && types[i] != KDL::BasicJointType::Continuous)
-      target = (ub(i) + lb(i)) / 2.0;
+    if (search_types[i] == KDL::BasicJointType::RotJoint && search_types[i] != KDL::BasicJointType::Continuous)
+      target = (search_ub(i) + search_lb(i)) / 2.0;
 
     double val = solution(i);
 
     normalizeAngle(val, target);
 
-    if (types[i] == KDL::BasicJointType::Continuous)
+    if (search_types[i] == KDL::BasicJointType::Continuous)
     {
       solution(i) = val;
       continue;
     }
 
-    normalizeAngle(val, lb(i), ub(i));
+    normalizeAngle(val, search_lb(i), search_ub(i));
 
     solution(i) = val;
   }
@@ -412,7 +555,43 @@ double TRAC_IK::ManipValue2(const KDL::JntArray& arr)
 }
 
 
-int TRAC_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL::JntArray &q_out, const KDL::Twist& _bounds)
+int TRAC_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL::JntArray &q_out, const KDL::Twist& _bounds, SolveStats* stats)
+{
+  return CartToJnt(q_init, p_in, lb, ub, q_out, _bounds, stats);
+}
+
+
+bool TRAC_IK::setSearchLimits(const KDL::JntArray &q_lower, const KDL::JntArray &q_upper)
+{
+  // The same rules as ChainIkSolverPos_TL::setSearchLimits(), so that the
+  // racers and the normalization agree on the box
+  search_lb.resize(lb.data.size());
+  search_ub.resize(ub.data.size());
+  search_types = types;
+  bool empty = false;
+  for (uint j = 0; j < lb.data.size(); j++)
+  {
+    search_lb(j) = std::max(lb(j), q_lower(j));
+    search_ub(j) = std::min(ub(j), q_upper(j));
+    if (search_lb(j) > search_ub(j))
+      empty = true;
+
+    if (search_types[j] == KDL::BasicJointType::Continuous &&
+        (search_ub(j) < std::numeric_limits<float>::max() || search_lb(j) > std::numeric_limits<float>::lowest()))
+      search_types[j] = KDL::BasicJointType::RotJoint;
+  }
+
+  for (size_t r = 0; r < racers.size(); r++)
+    if (racers[r]->kdl)
+      racers[r]->kdl->setSearchLimits(q_lower, q_upper);
+    else
+      racers[r]->nlopt->setSearchLimits(q_lower, q_upper);
+
+  return !empty;
+}
+
+
+int TRAC_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, const KDL::JntArray &q_lower, const KDL::JntArray &q_upper, KDL::JntArray &q_out, const KDL::Twist& _bounds, SolveStats* stats)
 {
 
   if (!initialized)
@@ -421,22 +600,140 @@ int TRAC_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL:
     return -1;
   }
 
+  if (q_init.data.size() != types.size())
+  {
+    ROS_ERROR_THROTTLE(1.0, "IK seeded with wrong number of joints.  Expected %d but got %d", (int)types.size(), (int)q_init.data.size());
+    return -3;
+  }
 
-  start_time = boost::posix_time::microsec_clock::local_time();
+  if (q_lower.data.size() != types.size() || q_upper.data.size() != types.size())
+  {
+    ROS_ERROR_THROTTLE(1.0, "IK search limits have the wrong number of joints.  Expected %d but got %d and %d", (int)types.size(), (int)q_lower.data.size(), (int)q_upper.data.size());
+    return -3;
+  }
 
-  nl_solver->reset();
-  iksolver->reset();
+  if (!setSearchLimits(q_lower, q_upper))
+  {
+    q_out = q_init;
+    return -3;
+  }
 
-  solutions.clear();
-  errors.clear();
+  deadline = Deadline(maxtime);
+
+  for (size_t r = 0; r < racers.size(); r++)
+    racers[r]->clear();
+  any_solution = false;
+
+  winner = SolveStats::NoRacer;
+  winning_racer = -1;
+  first_solution_time = -1;
+
+  // Only a Speed solve ends at its first solution, so only there can a
+  // head start save the other racers' work
+  bool adaptive = racer_selection == Adaptive && solvetype == Speed;
+  double head_start = 0;
+  held_back = SolveStats::NoRacer;
+  if (adaptive)
+    scheduler.plan(maxtime, held_back, head_start);
+  hold_until = deadline.time() - std::chrono::duration_cast<Deadline::Clock::duration>(std::chrono::duration<double>(maxtime - head_start));
+
+  collect_stats = stats || stats_collector || adaptive;
+
+  if (seed_db)
+  {
+    seed_db->nearest(p_in, seed_db_k, db_seeds);
+    // Stored configurations outside the search box would only be clamped
+    // back to its faces
+    size_t kept = 0;
+    for (size_t i = 0; i < db_seeds.size(); i++)
+    {
+      bool inside = true;
+      for (uint j = 0; j < search_types.size() && inside; j++)
+        if (search_types[j] != KDL::BasicJointType::Continuous)
+          inside = db_seeds[i](j) >= search_lb(j) && db_seeds[i](j) <= search_ub(j);
+      if (inside)
+        db_seeds[kept++] = db_seeds[i];
+    }
+    db_seeds.resize(kept);
+  }
+  else
+    db_seeds.clear();
 
   bounds = _bounds;
 
-  task1 = std::thread(&TRAC_IK::runKDL, this, q_init, p_in);
-  task2 = std::thread(&TRAC_IK::runNLOPT, this, q_init, p_in);
+  if (!pool || (!shared_pool && pool->size() + 1 < racers.size()))
+    pool.reset(new WorkerPool(std::max<size_t>(1, racers.size() - 1)));
+
+  std::vector<std::function<void()> > tasks;
+  if (held_back == SolveStats::NoRacer)
+  {
+    for (size_t r = 0; r < racers.size(); r++)
+      tasks.push_back([&, r]() { runRacer(r, q_init, p_in, deadline); });
+    pool->run(tasks);
+  }
+  else
+  {
+    // The favourites run alone until hold_until, and only if they have no
+    // solution by then do the others join them.  No thread waits out the
+    // hold, which on a busy pool would keep the favourites from running.
+    Deadline hold(hold_until);
+    for (size_t r = 0; r < racers.size(); r++)
+      if (racers[r]->config.kind != held_back)
+        tasks.push_back([&, r]() { runRacer(r, q_init, p_in, hold); });
+    pool->run(tasks);
+
+    if (!any_solution && !deadline.expired())
+    {
+      // Favourites first, so that a pool without idle workers keeps
+      // running them ahead of the others
+      tasks.clear();
+      for (size_t r = 0; r < racers.size(); r++)
+        if (racers[r]->config.kind != held_back)
+          tasks.push_back([&, r]() { runRacer(r, q_init, p_in, deadline); });
+      for (size_t r = 0; r < racers.size(); r++)
+        if (racers[r]->config.kind == held_back)
+          tasks.push_back([&, r]() { runRacer(r, q_init, p_in, deadline); });
+      pool->run(tasks);
+    }
+  }
 
-  task1.join();
-  task2.join();
+  if (adaptive)
+    scheduler.update(winner, first_solution_time, maxtime);
+
+  Deadline::Clock::time_point merge_start;
+  if (collect_stats)
+    merge_start = Deadline::Clock::now();
+  long merge_duplicates = 0;
+
+  solutions.clear();
+  errors.clear();
+
+  if (racers.size() == 1)
+  {
+    solutions = racers[0]->found.solutions;
+    for (size_t i = 0; i < solutions.size(); i++)
+      errors.push_back(std::make_pair(racers[0]->found.errors[i], i));
+  }
+  else
+  {
+    merged.clear();
+    for (size_t r = 0; r < racers.size(); r++)
+    {
+      const SolutionSet& found = racers[r]->found;
+      for (size_t i = 0; i < found.solutions.size(); i++)
+        if (!merged.contains(found.solutions[i]))
+        {
+          merged.add(found.solutions[i], found.errors[i]);
+          errors.push_back(std::make_pair(found.errors[i], solutions.size()));
+          solutions.push_back(found.solutions[i]);
+        }
+        else
+          merge_duplicates++;
+    }
+  }
+
+  if (collect_stats)
+    finishStats(stats, merge_start, merge_duplicates);
 
   if (solutions.empty())
   {
@@ -461,11 +758,188 @@ int TRAC_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in, KDL:
 }
 
 
+void TRAC_IK::runRacer(size_t index, const KDL::JntArray &q_init, const KDL::Frame &p_in, const Deadline& stop)
+{
+  Racer& racer = *racers[index];
+
+  // Another racer, maybe earlier on this very thread, has already won
+  if (solvetype == Speed && any_solution)
+    return;
+
+  if (racer.kdl)
+    runSolver(*racer.kdl, q_init, p_in, index, stop);
+  else
+    runSolver(*racer.nlopt, q_init, p_in, index, stop);
+}
+
+
+void TRAC_IK::finishStats(SolveStats* stats, const Deadline::Clock::time_point& merge_start, long merge_duplicates)
+{
+  SolveStats local;
+  SolveStats& out = stats ? *stats : local;
+
+  Deadline::Clock::time_point now = Deadline::Clock::now();
+
+  out.winner = winner;
+  out.winning_racer = winning_racer;
+  out.kdl_iterations = 0;
+  out.kdl_restarts = 0;
+  out.nlopt_evaluations = 0;
+  out.nlopt_restarts = 0;
+  out.duplicates_rejected = merge_duplicates;
+  for (size_t r = 0; r < racers.size(); r++)
+  {
+    const Racer& racer = *racers[r];
+    if (racer.kdl)
+    {
+      out.kdl_iterations += racer.work;
+      out.kdl_restarts += racer.restarts;
+    }
+    else
+    {
+      out.nlopt_evaluations += racer.work;
+      out.nlopt_restarts += racer.restarts;
+    }
+    out.duplicates_rejected += racer.duplicates;
+  }
+  out.held_back = held_back;
+  out.solutions = solutions.size();
+  out.time_to_first_solution = first_solution_time;
+  out.merge_time = std::chrono::duration<double>(now - merge_start).count();
+  out.total_time = maxtime - std::chrono::duration<double>(deadline.time() - now).count();
+
+  if (stats_collector)
+    stats_collector->record(out);
+}
+
+
+int TRAC_IK::CartToJntBatch(const std::vector<KDL::JntArray> &q_init, const std::vector<KDL::Frame> &p_in, std::vector<KDL::JntArray> &q_out, std::vector<int> &rc, const KDL::Twist& _bounds)
+{
+
+  if (!initialized)
+  {
+    ROS_ERROR("TRAC-IK was not properly initialized with a valid chain or limits.  IK cannot proceed");
+    return -1;
+  }
+
+  if (q_init.size() != 1 && q_init.size() != p_in.size())
+  {
+    ROS_ERROR("TRAC-IK batch needs one seed, or one seed per pose, but got %d seeds for %d poses", (int)q_init.size(), (int)p_in.size());
+    return -1;
+  }
+
+  q_out.resize(p_in.size());
+  rc.assign(p_in.size(), -3);
+
+  if (p_in.empty())
+    return 0;
+
+  // Unless the user handed us a pool, grow our own to use every core
+  uint num_threads = std::max(2u, std::thread::hardware_concurrency());
+  if (!pool || (!shared_pool && pool->size() + 1 < num_threads))
+  {
+    pool.reset(new WorkerPool(num_threads - 1));
+    batch_solvers.clear();
+  }
+
+  // Every pose runs the whole portfolio, so one thread in every
+  // racers.size() works on poses while the others pick up the other
+  // racers of each pose.
+  uint num_solvers = std::min<size_t>(std::max<size_t>(1, (pool->size() + 1) / racers.size()), p_in.size());
+
+  while (batch_solvers.size() < num_solvers)
+  {
+    batch_solvers.emplace_back(new TRAC_IK(chain, lb, ub, maxtime, eps, solvetype));
+    batch_solvers.back()->setWorkerPool(pool);
+    batch_solvers.back()->setPortfolio(portfolio);
+    batch_solvers.back()->setSeed(Random::derive(rng_seed, 1 + batch_solvers.size()));
+    batch_solvers.back()->setRestartStrategy(restart_strategy);
+    batch_solvers.back()->setSeedDatabase(seed_db, seed_db_k);
+  }
+
+  std::atomic<size_t> next_pose(0);
+  std::atomic<int> num_solved(0);
+
+  std::vector<std::function<void()> > workers;
+  for (uint w = 0; w < num_solvers; w++)
+  {
+    TRAC_IK* solver = batch_solvers[w].get();
+    solver->maxtime = maxtime;
+    solver->solvetype = solvetype;
+    solver->stats_collector = stats_collector;
+    if (solver->racer_selection != racer_selection)
+      solver->setRacerSelection(racer_selection);
+
+    workers.push_back([&, solver]()
+    {
+      size_t i;
+      while ((i = next_pose++) < p_in.size())
+      {
+        const KDL::JntArray& seed = q_init.size() == 1 ? q_init[0] : q_init[i];
+        rc[i] = solver->CartToJnt(seed, p_in[i], q_out[i], _bounds);
+        if (rc[i] >= 0)
+          num_solved++;
+      }
+    });
+  }
+
+  pool->run(workers);
+
+  return num_solved;
+}
+
+
+void TRAC_IK::setSeed(uint64_t seed)
+{
+  rng_seed = seed;
+
+  // Each racer draws its restarts from its own solver's generator, on its
+  // own thread
+  for (size_t r = 0; r < racers.size(); r++)
+    if (racers[r]->kdl)
+      racers[r]->kdl->setSeed(Random::derive(seed, r));
+    else
+      racers[r]->nlopt->setSeed(Random::derive(seed, r));
+
+  for (uint i = 0; i < batch_solvers.size(); i++)
+    batch_solvers[i]->setSeed(Random::derive(seed, 2 + i));
+}
+
+
+void TRAC_IK::setRestartStrategy(RestartStrategy strategy)
+{
+  restart_strategy = strategy;
+
+  for (size_t r = 0; r < racers.size(); r++)
+    if (racers[r]->kdl)
+      racers[r]->kdl->setRestartStrategy(strategy);
+    else
+      racers[r]->nlopt->setRestartStrategy(strategy);
+
+  for (uint i = 0; i < batch_solvers.size(); i++)
+    batch_solvers[i]->setRestartStrategy(strategy);
+}
+
+
+bool TRAC_IK::setSeedDatabase(const std::shared_ptr<const SeedDatabase>& db, unsigned int k)
+{
+  if (db && !db->matches(chain))
+  {
+    ROS_ERROR("TRAC-IK seed database was built for a different chain");
+    return false;
+  }
+
+  seed_db = db;
+  seed_db_k = k;
+
+  for (uint i = 0; i < batch_solvers.size(); i++)
+    batch_solvers[i]->setSeedDatabase(db, k);
+
+  return true;
+}
+
+
 TRAC_IK::~TRAC_IK()
 {
-  if (task1.joinable())
-    task1.join();
-  if (task2.joinable())
-    task2.join();
 }
 }
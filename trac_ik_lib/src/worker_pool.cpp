@@ -0,0 +1,119 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+#include <trac_ik/worker_pool.hpp>
+#include <algorithm>
+
+namespace TRAC_IK
+{
+
+WorkerPool::WorkerPool(unsigned int num_workers) :
+  stopping(false)
+{
+  for (unsigned int i = 0; i < num_workers; i++)
+    workers.push_back(std::thread(&WorkerPool::workerLoop, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stopping = true;
+  }
+  wakeup.notify_all();
+
+  for (uint i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
+size_t WorkerPool::claim(Batch& batch)
+{
+  size_t i = batch.next++;
+
+  // Once the last task is handed out nobody else needs to see this batch
+  if (batch.next == batch.tasks.size())
+  {
+    std::deque<Batch*>::iterator it = std::find(pending.begin(), pending.end(), &batch);
+    if (it != pending.end())
+      pending.erase(it);
+  }
+
+  return i;
+}
+
+void WorkerPool::run(const std::vector<std::function<void()> >& tasks)
+{
+  if (tasks.empty())
+    return;
+
+  Batch batch(tasks);
+
+  std::unique_lock<std::mutex> lock(mtx_);
+
+  if (tasks.size() > 1 && !workers.empty())
+  {
+    pending.push_back(&batch);
+    wakeup.notify_all();
+  }
+
+  while (batch.next < tasks.size())
+  {
+    size_t i = claim(batch);
+    lock.unlock();
+    tasks[i]();
+    lock.lock();
+    batch.done++;
+  }
+
+  batch.finished.wait(lock, [&batch] { return batch.done == batch.tasks.size(); });
+}
+
+void WorkerPool::workerLoop()
+{
+  std::unique_lock<std::mutex> lock(mtx_);
+
+  while (true)
+  {
+    wakeup.wait(lock, [this] { return stopping || !pending.empty(); });
+
+    if (pending.empty())
+      return;
+
+    Batch& batch = *pending.front();
+    size_t i = claim(batch);
+    lock.unlock();
+    batch.tasks[i]();
+    lock.lock();
+    if (++batch.done == batch.tasks.size())
+      batch.finished.notify_all();
+  }
+}
+
+}
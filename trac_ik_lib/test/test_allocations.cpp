@@ -0,0 +1,135 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+// ChainIkSolverPos_TL::CartToJnt must not touch the heap once its solver
+// is built, whatever the chain size and step type.  Eigen, and so
+// KDL::JntArray, calls malloc directly rather than operator new, so the
+// test counts calls to malloc itself.
+
+#include <gtest/gtest.h>
+#include <trac_ik/kdl_tl.hpp>
+#include <trac_ik/synthetic_chains.hpp>
+#include <kdl/chainfksolverpos_recursive.hpp>
+#include <atomic>
+
+namespace chains = TRAC_IK::SyntheticChains;
+
+#ifdef __GLIBC__
+
+namespace
+{
+
+std::atomic<size_t> allocations(0);
+
+}
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t num, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+extern "C" void* malloc(size_t size) noexcept
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t num, size_t size) noexcept
+{
+  allocations++;
+  return __libc_calloc(num, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) noexcept
+{
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+// Reachable targets from the zero configuration, and unreachable ones
+// that keep the solver iterating and restarting until the timeout
+TEST(ChainIkSolverPos_TL, IterationsDoNotAllocate)
+{
+  const KDL::ChainIkSolverPos_TL::StepType step_types[] =
+  {
+    KDL::ChainIkSolverPos_TL::PseudoInverse,
+    KDL::ChainIkSolverPos_TL::LevenbergMarquardt,
+    KDL::ChainIkSolverPos_TL::EigenPseudoInverse
+  };
+
+  for (chains::MakeChain make : chains::ALL_CHAINS)
+  {
+    KDL::Chain chain;
+    KDL::JntArray ll, ul;
+    make(chain, ll, ul);
+    unsigned int n = chain.getNrOfJoints();
+
+    KDL::ChainFkSolverPos_recursive fk_solver(chain);
+    TRAC_IK::Random rng(11);
+    std::vector<KDL::Frame> targets(20);
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+      fk_solver.JntToCart(chains::randomConfig(rng, ll, ul), targets[i]);
+      if (i % 2)
+        targets[i].p += KDL::Vector(10, 10, 10);
+    }
+
+    for (KDL::ChainIkSolverPos_TL::StepType step_type : step_types)
+    {
+      KDL::ChainIkSolverPos_TL solver(chain, ll, ul, 0.001, 1e-5, true, true);
+      solver.setStepType(step_type);
+
+      size_t before = allocations;
+      KDL::JntArray seed(n), result(n);
+      ASSERT_GT(allocations - before, 0u) << "malloc is not being counted";
+
+      for (size_t i = 0; i < targets.size(); i++)
+      {
+        size_t before = allocations;
+        solver.CartToJnt(seed, targets[i], result);
+        size_t allocated = allocations - before;
+
+        EXPECT_EQ(0u, allocated) << n << " joints, step type " << step_type << ", target " << i
+                                 << ", " << solver.getIterations() << " iterations";
+        if (i % 2)
+        {
+          EXPECT_GT(solver.getIterations(), 1);
+        }
+      }
+    }
+  }
+}
+
+#endif
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
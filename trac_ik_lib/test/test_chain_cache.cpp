@@ -0,0 +1,96 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+// ChainCache: a saved chain maps back with the same structure, limits and
+// poses, and only for the URDF and links it was saved under
+
+#include <gtest/gtest.h>
+#include <trac_ik/chain_cache.hpp>
+#include <trac_ik/seed_database.hpp>
+#include <kdl/chainfksolverpos_recursive.hpp>
+#include <trac_ik/synthetic_chains.hpp>
+#include <cstdlib>
+#include <unistd.h>
+
+namespace chains = TRAC_IK::SyntheticChains;
+
+TEST(ChainCache, SaveAndLoad)
+{
+  char dir[] = "/tmp/trac_ik_test_chainsXXXXXX";
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  TRAC_IK::ChainCache cache(dir);
+
+  int index = 0;
+  for (chains::MakeChain make : chains::ALL_CHAINS)
+  {
+    KDL::Chain chain;
+    KDL::JntArray ll, ul;
+    make(chain, ll, ul);
+    const std::string urdf_xml = "<robot name=\"chain" + std::to_string(index++) + "\"/>";
+
+    ASSERT_TRUE(cache.save(urdf_xml, "base", "tip", chain, ll, ul));
+
+    KDL::Chain loaded;
+    KDL::JntArray loaded_ll, loaded_ul;
+    EXPECT_FALSE(cache.load(urdf_xml, "base", "other_tip", loaded, loaded_ll, loaded_ul));
+    EXPECT_FALSE(cache.load("<robot name=\"other\"/>", "base", "tip", loaded, loaded_ll, loaded_ul));
+    ASSERT_TRUE(cache.load(urdf_xml, "base", "tip", loaded, loaded_ll, loaded_ul));
+
+    EXPECT_EQ(chain.getNrOfJoints(), loaded.getNrOfJoints());
+    EXPECT_TRUE(loaded_ll.data == ll.data);
+    EXPECT_TRUE(loaded_ul.data == ul.data);
+    EXPECT_EQ(TRAC_IK::SeedDatabase::chainHash(chain), TRAC_IK::SeedDatabase::chainHash(loaded));
+
+    // Rebuilt joints renormalize their axes, so poses may move in the
+    // last bit
+    KDL::ChainFkSolverPos_recursive fk_solver(chain), loaded_fk_solver(loaded);
+    TRAC_IK::Random rng(6);
+    for (int i = 0; i < 100; i++)
+    {
+      KDL::JntArray q = chains::randomConfig(rng, ll, ul);
+      KDL::Frame pose, loaded_pose;
+      fk_solver.JntToCart(q, pose);
+      loaded_fk_solver.JntToCart(q, loaded_pose);
+      KDL::Twist error = KDL::diff(pose, loaded_pose);
+      for (int k = 0; k < 6; k++)
+        EXPECT_NEAR(0, error[k], 1e-12);
+    }
+
+    unlink(cache.path(urdf_xml, "base", "tip").c_str());
+  }
+
+  rmdir(dir);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
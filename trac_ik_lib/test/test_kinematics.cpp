@@ -0,0 +1,205 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+// ChainKinematics against the KDL solvers, and the analytic objective
+// gradients of NLOPT_IK against finite differences
+
+#include <gtest/gtest.h>
+#include <trac_ik/chain_kinematics.hpp>
+#include <trac_ik/nlopt_ik.hpp>
+#include <trac_ik/synthetic_chains.hpp>
+
+namespace chains = TRAC_IK::SyntheticChains;
+
+namespace
+{
+
+void expectFramesNear(const KDL::Frame& expected, const KDL::Frame& actual, double tolerance)
+{
+  KDL::Twist error = KDL::diff(expected, actual);
+  for (int k = 0; k < 6; k++)
+    EXPECT_NEAR(0, error[k], tolerance);
+}
+
+}
+
+TEST(ChainKinematics, MatchesKDL)
+{
+  for (chains::MakeChain make : chains::ALL_CHAINS)
+  {
+    KDL::Chain chain;
+    KDL::JntArray ll, ul;
+    make(chain, ll, ul);
+    unsigned int n = chain.getNrOfJoints();
+
+    KDL::ChainKinematics kinematics(chain);
+    KDL::ChainFkSolverPos_recursive fk_solver(chain);
+    KDL::ChainJntToJacSolver jac_solver(chain);
+    TRAC_IK::Random rng(1);
+
+    for (int i = 0; i < 100; i++)
+    {
+      KDL::JntArray q = chains::randomConfig(rng, ll, ul);
+      KDL::Frame expected, pose, pose_jac;
+      KDL::Jacobian expected_jac(n), jac(n);
+      fk_solver.JntToCart(q, expected);
+      jac_solver.JntToJac(q, expected_jac);
+
+      ASSERT_GE(kinematics.JntToCart(q, pose), 0);
+      ASSERT_GE(kinematics.JntToCartJac(q, pose_jac, jac), 0);
+      expectFramesNear(expected, pose, 1e-12);
+      expectFramesNear(expected, pose_jac, 1e-12);
+      EXPECT_LT((expected_jac.data - jac.data).norm(), 1e-12);
+    }
+  }
+}
+
+// Counts that are not multiples of BATCH_WIDTH exercise the padded lanes
+TEST(ChainKinematics, BatchMatchesKDL)
+{
+  for (chains::MakeChain make : chains::ALL_CHAINS)
+  {
+    KDL::Chain chain;
+    KDL::JntArray ll, ul;
+    make(chain, ll, ul);
+    unsigned int n = chain.getNrOfJoints();
+
+    KDL::ChainKinematics kinematics(chain);
+    KDL::ChainFkSolverPos_recursive fk_solver(chain);
+    TRAC_IK::Random rng(2);
+
+    for (size_t count = 1; count <= 3 * KDL::ChainKinematics::BATCH_WIDTH + 1; count++)
+    {
+      std::vector<KDL::JntArray> configs;
+      std::vector<double> flat;
+      for (size_t i = 0; i < count; i++)
+      {
+        configs.push_back(chains::randomConfig(rng, ll, ul));
+        flat.insert(flat.end(), configs[i].data.data(), configs[i].data.data() + n);
+      }
+
+      std::vector<KDL::Frame> poses(count), vector_poses;
+      kinematics.JntToCartBatch(flat.data(), count, poses.data());
+      ASSERT_GE(kinematics.JntToCartBatch(configs, vector_poses), 0);
+      ASSERT_EQ(count, vector_poses.size());
+
+      for (size_t i = 0; i < count; i++)
+      {
+        KDL::Frame expected;
+        fk_solver.JntToCart(configs[i], expected);
+        expectFramesNear(expected, poses[i], 1e-12);
+        expectFramesNear(expected, vector_poses[i], 1e-12);
+      }
+    }
+  }
+}
+
+// Each objective is compared with central differences at random
+// configurations.  The targets are moved out of reach, so that the error
+// is never zero and the short solve that sets them up leaves the solver
+// ready to evaluate errors.
+TEST(NLOPT_IK, GradientsMatchFiniteDifferences)
+{
+  const NLOPT_IK::OptType types[] = {NLOPT_IK::SumSq, NLOPT_IK::L2, NLOPT_IK::DualQuat};
+  const double h = 1e-6;
+
+  for (chains::MakeChain make : chains::ALL_CHAINS)
+  {
+    KDL::Chain chain;
+    KDL::JntArray ll, ul;
+    make(chain, ll, ul);
+    unsigned int n = chain.getNrOfJoints();
+
+    KDL::ChainFkSolverPos_recursive fk_solver(chain);
+    TRAC_IK::Random rng(3);
+
+    for (NLOPT_IK::OptType type : types)
+    {
+      NLOPT_IK::NLOPT_IK solver(chain, ll, ul, 0.005, 1e-5, type);
+
+      for (int i = 0; i < 20; i++)
+      {
+        KDL::Frame target;
+        fk_solver.JntToCart(chains::randomConfig(rng, ll, ul), target);
+        target.p += KDL::Vector(10, 10, 10);
+        KDL::JntArray result(n);
+        ASSERT_LT(solver.CartToJnt(KDL::JntArray(n), target, result, TRAC_IK::Deadline(0.0001)), 0);
+
+        KDL::JntArray q = chains::randomConfig(rng, ll, ul);
+        std::vector<double> x(q.data.data(), q.data.data() + n), grad(n);
+        double error[1];
+
+        switch (type)
+        {
+        case NLOPT_IK::L2:
+          solver.cartL2NormError(x, error, grad.data());
+          break;
+        case NLOPT_IK::DualQuat:
+          solver.cartDQError(x, error, grad.data());
+          break;
+        default:
+          solver.cartSumSquaredError(x, error, grad.data());
+          break;
+        }
+
+        for (unsigned int j = 0; j < n; j++)
+        {
+          std::vector<double> plus = x, minus = x;
+          plus[j] += h;
+          minus[j] -= h;
+          double error_plus[1], error_minus[1];
+          switch (type)
+          {
+          case NLOPT_IK::L2:
+            solver.cartL2NormError(plus, error_plus);
+            solver.cartL2NormError(minus, error_minus);
+            break;
+          case NLOPT_IK::DualQuat:
+            solver.cartDQError(plus, error_plus);
+            solver.cartDQError(minus, error_minus);
+            break;
+          default:
+            solver.cartSumSquaredError(plus, error_plus);
+            solver.cartSumSquaredError(minus, error_minus);
+            break;
+          }
+          double numeric = (error_plus[0] - error_minus[0]) / (2 * h);
+          EXPECT_NEAR(numeric, grad[j], 1e-5 * std::max(1.0, std::abs(numeric))) << "type " << type << " joint " << j;
+        }
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,233 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+// SeedDatabase: the k-d search against a brute force scan, and saving,
+// mapping and rejecting files
+
+#include <gtest/gtest.h>
+#include <trac_ik/seed_database.hpp>
+#include <kdl/chainfksolverpos_recursive.hpp>
+#include <trac_ik/synthetic_chains.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+namespace chains = TRAC_IK::SyntheticChains;
+
+namespace
+{
+
+// The distance nearest() ranks by, see SeedDatabase.  q and -q are the
+// same rotation, so the nearer of the two counts.
+double keyDistance(const KDL::Frame& a, const KDL::Frame& b, double scale)
+{
+  double qa[4], qb[4];
+  a.M.GetQuaternion(qa[0], qa[1], qa[2], qa[3]);
+  b.M.GetQuaternion(qb[0], qb[1], qb[2], qb[3]);
+
+  double position = (a.p - b.p).Norm() * (a.p - b.p).Norm();
+  double same = 0, opposite = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    same += (qa[i] - qb[i]) * (qa[i] - qb[i]);
+    opposite += (qa[i] + qb[i]) * (qa[i] + qb[i]);
+  }
+  return position + scale * scale * std::min(same, opposite);
+}
+
+std::string tempPath()
+{
+  char path[] = "/tmp/trac_ik_test_seedsXXXXXX";
+  int fd = mkstemp(path);
+  if (fd >= 0)
+    close(fd);
+  return path;
+}
+
+std::vector<char> readFile(const std::string& path)
+{
+  std::ifstream in(path.c_str(), std::ios::binary);
+  return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::string& path, const std::vector<char>& data)
+{
+  std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+  out.write(data.data(), data.size());
+}
+
+}
+
+// Listing every entry through nearest() with k = size(), the k nearest by
+// the brute force distance must be exactly what nearest() returns for k
+TEST(SeedDatabase, NearestMatchesBruteForce)
+{
+  KDL::Chain chain;
+  KDL::JntArray ll, ul;
+  chains::makeArm7(chain, ll, ul);
+
+  TRAC_IK::SeedDatabase db;
+  ASSERT_TRUE(db.build(chain, ll, ul, 2000));
+  ASSERT_EQ(2000u, db.size());
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  std::vector<KDL::JntArray> all;
+  db.nearest(KDL::Frame::Identity(), db.size(), all);
+  ASSERT_EQ(db.size(), all.size());
+  std::vector<KDL::Frame> stored(all.size());
+  for (size_t i = 0; i < all.size(); i++)
+    fk_solver.JntToCart(all[i], stored[i]);
+
+  TRAC_IK::Random rng(4);
+  const unsigned int ks[] = {1, 8, 50};
+  for (int i = 0; i < 200; i++)
+  {
+    KDL::Frame target;
+    fk_solver.JntToCart(chains::randomConfig(rng, ll, ul), target);
+    // Half turns have w near 0, where the stored sign of q may differ
+    if (i % 2)
+      target.M = KDL::Rotation::Rot(KDL::Vector(rng.uniform(-1, 1), rng.uniform(-1, 1), rng.uniform(-1, 1)),
+                                    M_PI - rng.uniform(0, 0.1));
+
+    std::vector<double> brute(stored.size());
+    for (size_t e = 0; e < stored.size(); e++)
+      brute[e] = keyDistance(target, stored[e], db.rotationScale());
+    std::sort(brute.begin(), brute.end());
+
+    for (unsigned int k : ks)
+    {
+      std::vector<KDL::JntArray> seeds;
+      db.nearest(target, k, seeds);
+      ASSERT_EQ(k, seeds.size());
+      for (unsigned int s = 0; s < k; s++)
+      {
+        KDL::Frame pose;
+        fk_solver.JntToCart(seeds[s], pose);
+        EXPECT_NEAR(brute[s], keyDistance(target, pose, db.rotationScale()), 1e-9) << "neighbour " << s << " of " << k;
+      }
+    }
+  }
+}
+
+TEST(SeedDatabase, SaveAndLoad)
+{
+  KDL::Chain chain, other;
+  KDL::JntArray ll, ul, other_ll, other_ul;
+  chains::makeArm7(chain, ll, ul);
+  chains::makeArm6(other, other_ll, other_ul);
+
+  TRAC_IK::SeedDatabase built;
+  ASSERT_TRUE(built.build(chain, ll, ul, 500));
+  std::string path = tempPath();
+  ASSERT_TRUE(built.save(path));
+
+  TRAC_IK::SeedDatabase loaded;
+  ASSERT_TRUE(loaded.load(path));
+  unlink(path.c_str());
+
+  EXPECT_EQ(built.size(), loaded.size());
+  EXPECT_EQ(built.getNrOfJoints(), loaded.getNrOfJoints());
+  EXPECT_EQ(built.rotationScale(), loaded.rotationScale());
+  EXPECT_TRUE(loaded.matches(chain));
+  EXPECT_FALSE(loaded.matches(other));
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  TRAC_IK::Random rng(5);
+  for (int i = 0; i < 20; i++)
+  {
+    KDL::Frame target;
+    fk_solver.JntToCart(chains::randomConfig(rng, ll, ul), target);
+    std::vector<KDL::JntArray> a, b;
+    built.nearest(target, 8, a);
+    loaded.nearest(target, 8, b);
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t s = 0; s < a.size(); s++)
+      EXPECT_TRUE(a[s].data == b[s].data);
+  }
+}
+
+// The header is 8 bytes of magic, then version and num_joints (uint32),
+// then num_entries (uint64).  The last num_entries bytes are the split
+// dimensions of the tree.
+TEST(SeedDatabase, RejectsMalformedFiles)
+{
+  KDL::Chain chain;
+  KDL::JntArray ll, ul;
+  chains::makeArm7(chain, ll, ul);
+
+  TRAC_IK::SeedDatabase built;
+  ASSERT_TRUE(built.build(chain, ll, ul, 500));
+  std::string path = tempPath();
+  ASSERT_TRUE(built.save(path));
+  const std::vector<char> good = readFile(path);
+
+  TRAC_IK::SeedDatabase db;
+  std::vector<char> bad = good;
+  bad[0] = 'X';
+  writeFile(path, bad);
+  EXPECT_FALSE(db.load(path));
+
+  bad = good;
+  bad.pop_back();
+  writeFile(path, bad);
+  EXPECT_FALSE(db.load(path));
+
+  bad = good;
+  bad[bad.size() - 100] = 7;
+  writeFile(path, bad);
+  EXPECT_FALSE(db.load(path));
+
+  bad = good;
+  uint32_t num_joints = 0xffffffffu;
+  memcpy(&bad[12], &num_joints, sizeof(num_joints));
+  writeFile(path, bad);
+  EXPECT_FALSE(db.load(path));
+
+  // Large enough to wrap around in the size computation
+  bad = good;
+  uint64_t num_entries = (uint64_t(1) << 63) + 500;
+  memcpy(&bad[16], &num_entries, sizeof(num_entries));
+  writeFile(path, bad);
+  EXPECT_FALSE(db.load(path));
+
+  EXPECT_EQ(0u, db.size());
+
+  writeFile(path, good);
+  EXPECT_TRUE(db.load(path));
+  unlink(path.c_str());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,274 @@
+/********************************************************************************
+Copyright (c) 2015, TRACLabs, Inc.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+OF THE POSSIBILITY OF SUCH DAMAGE.
+********************************************************************************/
+
+// The solvers: repeatable restarts for equal seeds, searches that stay
+// within the limits they are given, adaptive racer selection, and
+// concurrent solvers
+
+#include <gtest/gtest.h>
+#include <trac_ik/trac_ik.hpp>
+#include <kdl/chainfksolverpos_recursive.hpp>
+#include <trac_ik/synthetic_chains.hpp>
+#include <atomic>
+#include <limits>
+#include <thread>
+
+namespace chains = TRAC_IK::SyntheticChains;
+
+TEST(ChainIkSolverPos_TL, EqualSeedsGiveEqualSolutions)
+{
+  KDL::Chain chain;
+  KDL::JntArray ll, ul;
+  chains::makeArm7(chain, ll, ul);
+  unsigned int n = chain.getNrOfJoints();
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  KDL::ChainIkSolverPos_TL solver1(chain, ll, ul, 0.05, 1e-5, true, true);
+  KDL::ChainIkSolverPos_TL solver2(chain, ll, ul, 0.05, 1e-5, true, true);
+  solver1.setSeed(42);
+  solver2.setSeed(42);
+
+  TRAC_IK::Random rng(7);
+  int compared = 0;
+  for (int i = 0; i < 50; i++)
+  {
+    KDL::Frame target;
+    fk_solver.JntToCart(chains::randomConfig(rng, ll, ul), target);
+
+    // Both always run, so that their generators stay in step
+    KDL::JntArray result1, result2;
+    int rc1 = solver1.CartToJnt(KDL::JntArray(n), target, result1);
+    int rc2 = solver2.CartToJnt(KDL::JntArray(n), target, result2);
+    if (rc1 < 0 || rc2 < 0)
+      continue;
+
+    compared++;
+    EXPECT_TRUE(result1.data == result2.data);
+  }
+  EXPECT_GT(compared, 25);
+}
+
+// Solutions near the seed, within a box of +-0.4 around it that also
+// bounds the continuous joint
+TEST(TRAC_IK, SearchLimitsBoundSolutions)
+{
+  KDL::Chain chain;
+  KDL::JntArray ll, ul;
+  chains::makeArm7(chain, ll, ul);
+  ll(6) = std::numeric_limits<double>::lowest();
+  ul(6) = std::numeric_limits<double>::max();
+  unsigned int n = chain.getNrOfJoints();
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  TRAC_IK::TRAC_IK solver(chain, ll, ul, 0.005, 1e-5, TRAC_IK::Distance);
+  TRAC_IK::Random rng(8);
+
+  int solved = 0;
+  const int trials = 100;
+  for (int i = 0; i < trials; i++)
+  {
+    KDL::JntArray q = chains::randomConfig(rng, ll, ul);
+    KDL::JntArray seed(n), lower(n), upper(n), result(n);
+    for (unsigned int j = 0; j < n; j++)
+    {
+      seed(j) = q(j) + rng.uniform(-0.3, 0.3);
+      lower(j) = seed(j) - 0.4;
+      upper(j) = seed(j) + 0.4;
+    }
+
+    KDL::Frame target;
+    fk_solver.JntToCart(q, target);
+    if (solver.CartToJnt(seed, target, lower, upper, result) < 0)
+      continue;
+
+    solved++;
+    for (unsigned int j = 0; j < n; j++)
+    {
+      EXPECT_GE(result(j), std::max(lower(j), ll(j)) - 1e-9) << "joint " << j;
+      EXPECT_LE(result(j), std::min(upper(j), ul(j)) + 1e-9) << "joint " << j;
+    }
+  }
+  EXPECT_GT(solved, trials / 2);
+
+  // Wrongly sized limits are refused
+  KDL::JntArray result;
+  EXPECT_LT(solver.CartToJnt(KDL::JntArray(n), KDL::Frame::Identity(), KDL::JntArray(n - 1), KDL::JntArray(n), result), 0);
+
+  // A box that misses the limits of a joint fails, even for a reachable
+  // target, in TRAC_IK as in each solver on its own
+  KDL::JntArray q(n), lower(n), upper(n);
+  KDL::Frame target;
+  fk_solver.JntToCart(q, target);
+  for (unsigned int j = 0; j < n; j++)
+  {
+    lower(j) = -0.4;
+    upper(j) = 0.4;
+  }
+  lower(0) = ul(0) + 0.1;
+  upper(0) = ul(0) + 0.5;
+
+  EXPECT_LT(solver.CartToJnt(q, target, lower, upper, result), 0);
+  EXPECT_TRUE(result.data == q.data);
+  EXPECT_GE(solver.CartToJnt(q, target, result), 0);
+
+  KDL::ChainIkSolverPos_TL kdl_solver(chain, ll, ul, 0.005, 1e-5, true, true);
+  EXPECT_FALSE(kdl_solver.setSearchLimits(lower, upper));
+  EXPECT_LT(kdl_solver.CartToJnt(q, target, result), 0);
+  kdl_solver.clearSearchLimits();
+  EXPECT_GE(kdl_solver.CartToJnt(q, target, result), 0);
+
+  NLOPT_IK::NLOPT_IK nlopt_solver(chain, ll, ul, 0.005, 1e-5);
+  EXPECT_FALSE(nlopt_solver.setSearchLimits(lower, upper));
+  EXPECT_LT(nlopt_solver.CartToJnt(q, target, result), 0);
+  nlopt_solver.clearSearchLimits();
+  EXPECT_GE(nlopt_solver.CartToJnt(q, target, result), 0);
+}
+
+// Adaptive Speed solves on a pool whose only worker is busy, as under
+// CartToJntBatch.  NLopt refuses single-joint chains, so the KDL racer
+// wins every race and the NLopt racer is held back.  Listed first, it is
+// the task the calling thread reaches first, yet KDL must still solve.
+TEST(TRAC_IK, AdaptiveHoldKeepsFavouriteRunning)
+{
+  KDL::Chain chain;
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::RotZ), KDL::Frame(KDL::Vector(0.3, 0, 0))));
+  KDL::JntArray ll(1), ul(1);
+  ll(0) = -2.9;
+  ul(0) = 2.9;
+
+  TRAC_IK::TRAC_IK solver(chain, ll, ul, 0.005, 1e-5, TRAC_IK::Speed);
+  std::vector<TRAC_IK::RacerConfig> portfolio;
+  portfolio.push_back(TRAC_IK::RacerConfig(TRAC_IK::SolveStats::NLOPTRacer));
+  portfolio.push_back(TRAC_IK::RacerConfig(TRAC_IK::SolveStats::KDLRacer));
+  ASSERT_TRUE(solver.setPortfolio(portfolio));
+  solver.setRacerSelection(TRAC_IK::Adaptive);
+  std::shared_ptr<TRAC_IK::WorkerPool> pool = std::make_shared<TRAC_IK::WorkerPool>(1);
+  solver.setWorkerPool(pool);
+
+  KDL::ChainFkSolverPos_recursive fk_solver(chain);
+  TRAC_IK::Random rng(9);
+  KDL::JntArray seed(1), result;
+  KDL::Frame target;
+
+  // Enough full races for the scheduler to settle on KDL
+  for (int i = 0; i < 20; i++)
+  {
+    fk_solver.JntToCart(chains::randomConfig(rng, ll, ul), target);
+    ASSERT_GE(solver.CartToJnt(seed, target, result), 0);
+  }
+
+  // The blocking thread and the worker each spin in one of these
+  std::atomic<int> blocking(0);
+  std::atomic<bool> release(false);
+  std::thread blocker([&]()
+  {
+    std::vector<std::function<void()> > tasks(2, [&]()
+    {
+      blocking++;
+      while (!release)
+        std::this_thread::yield();
+    });
+    pool->run(tasks);
+  });
+  while (blocking < 2)
+    std::this_thread::yield();
+
+  int held = 0;
+  for (int i = 0; i < 20; i++)
+  {
+    fk_solver.JntToCart(chains::randomConfig(rng, ll, ul), target);
+    TRAC_IK::SolveStats stats;
+    int rc = solver.CartToJnt(seed, target, result, KDL::Twist::Zero(), &stats);
+    if (stats.held_back != TRAC_IK::SolveStats::NLOPTRacer)
+      continue;
+
+    held++;
+    EXPECT_GE(rc, 0);
+    EXPECT_EQ(TRAC_IK::SolveStats::KDLRacer, stats.winner);
+  }
+
+  release = true;
+  blocker.join();
+  EXPECT_GT(held, 10);
+}
+
+// Many DualQuat solvers at once, one per thread, each with its own
+// targets.  Any state shared between instances would send a solver towards
+// another thread's target.
+TEST(NLOPT_IK, ConcurrentDualQuatInstances)
+{
+  KDL::Chain chain;
+  KDL::JntArray ll, ul;
+  chains::makeArm7(chain, ll, ul);
+  unsigned int n = chain.getNrOfJoints();
+
+  const unsigned int num_threads = std::max(4u, std::thread::hardware_concurrency());
+  const int num_samples = 50;
+  std::atomic<int> solved(0), wrong(0);
+
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t < num_threads; t++)
+    threads.push_back(std::thread([&, t]()
+    {
+      KDL::ChainFkSolverPos_recursive fk_solver(chain);
+      NLOPT_IK::NLOPT_IK solver(chain, ll, ul, 0.005, 1e-5, NLOPT_IK::DualQuat);
+      TRAC_IK::Random rng(TRAC_IK::Random::derive(10, t));
+      KDL::JntArray seed(n), result;
+      KDL::Frame target, reached;
+
+      for (int i = 0; i < num_samples; i++)
+      {
+        KDL::JntArray q = chains::randomConfig(rng, ll, ul);
+        fk_solver.JntToCart(q, target);
+        for (unsigned int j = 0; j < n; j++)
+          seed(j) = std::min(ul(j), std::max(ll(j), q(j) + 0.1));
+
+        if (solver.CartToJnt(seed, target, result) < 0)
+          continue;
+
+        solved++;
+        fk_solver.JntToCart(result, reached);
+        if (!KDL::Equal(KDL::diff(target, reached), KDL::Twist::Zero(), 1e-4))
+          wrong++;
+      }
+    }));
+
+  for (unsigned int t = 0; t < num_threads; t++)
+    threads[t].join();
+
+  EXPECT_EQ(0, wrong.load());
+  EXPECT_GT(solved.load(), int(num_threads * num_samples / 2));
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,66 @@
+#!/usr/bin/env python
+
+from trac_ik_python.trac_ik import IK
+from numpy.random import random
+import multiprocessing
+import threading
+import time
+
+
+def solve_all(ik_solver, coords, found):
+    qinit = [0.] * ik_solver.number_of_joints
+    for x, y, z in coords:
+        if ik_solver.get_ik(qinit,
+                            x, y, z,
+                            0.0, 0.0, 0.0, 1.0,
+                            0.001, 0.001, 0.001,
+                            9999.0, 9999.0, 9999.0):
+            found.append(1)
+
+
+if __name__ == '__main__':
+    # roslaunch pr2_description upload_pr2.launch
+    # Needed beforehand
+
+    # Generate a set of random coords in the arm workarea approx
+    NUM_COORDS = 400
+    rand_coords = []
+    for _ in range(NUM_COORDS):
+        x = random() * 0.5
+        y = random() * 0.6 + -0.3
+        z = random() * 0.7 + -0.35
+        rand_coords.append((x, y, z))
+
+    # The IK calls release the GIL, so with one IK instance per thread
+    # the same coords should be solved close to num_threads times faster,
+    # until the cores run out.  Each instance races its solvers on two
+    # threads of its own, so expect near linear scaling up to about half
+    # the cores.
+    max_threads = max(1, multiprocessing.cpu_count() // 2)
+    num_threads = 1
+    serial_time = None
+    while num_threads <= max_threads:
+        solvers = [IK("torso_lift_link", "r_wrist_roll_link")
+                   for _ in range(num_threads)]
+        found = []
+        threads = [threading.Thread(target=solve_all,
+                                    args=(solvers[t],
+                                          rand_coords[t::num_threads],
+                                          found))
+                   for t in range(num_threads)]
+
+        ini_t = time.time()
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        fin_t = time.time()
+
+        if serial_time is None:
+            serial_time = fin_t - ini_t
+
+        print("Threads: " + str(num_threads) +
+              "  found " + str(len(found)) + " of " + str(NUM_COORDS) +
+              "  took " + str(fin_t - ini_t) +
+              "  speedup " + str(serial_time / (fin_t - ini_t)))
+        num_threads *= 2
@@ -2,6 +2,7 @@
 
 from trac_ik_python.trac_ik_wrap import TRAC_IK
 import rospy
+import numpy as np
 from numpy.random import random
 import time
 
@@ -121,6 +122,24 @@ if __name__ == '__main__':
     print("Average IK call time: " + str(avg_time))
     print()
 
+    # The same random coords in one batch call, spread over all cores
+    poses = np.zeros((NUM_COORDS, 7))
+    poses[:, 0:3] = rand_coords
+    poses[:, 6] = 1.0
+    solutions = np.zeros((NUM_COORDS, 7))
+    status = np.zeros(NUM_COORDS, dtype=np.int32)
+    ini_t = time.time()
+    num_solutions_found = ik_solver.CartToJntBatch(np.zeros(7), poses,
+                                                   solutions, status,
+                                                   bx, by, bz,
+                                                   brx, bry, brz)
+    fin_t = time.time()
+
+    print()
+    print("Found " + str(num_solutions_found) + " of 200 random coords in one batch")
+    print("Average IK time per coord: " + str((fin_t - ini_t) / NUM_COORDS))
+    print()
+
 # std::vector<double> CartToJnt(const std::vector<double> q_init,
 # const double x, const double y, const double z,
 # const double rx, const double ry, const double rz, const double rw,
@@ -5,9 +5,17 @@
 
 from trac_ik_python.trac_ik_wrap import TRAC_IK
 import rospy
+import threading
 
 
 class IK(object):
+    """
+    The solves release the GIL, so Python threads solve in parallel as
+    long as each uses its own IK instance. An IK instance may be shared
+    between threads, but its calls then take turns. The TRAC_IK object
+    underneath must never be called from two threads at once.
+    """
+
     def __init__(self, base_link, tip_link,
                  timeout=0.005, epsilon=1e-5, solve_type="Speed",
                  urdf_string=None):
@@ -38,9 +46,10 @@ class IK(object):
                                   self._epsilon,
                                   self._solve_type)
         self.number_of_joints = self._ik_solver.getNrOfJointsInChain()
-        self.joint_names = self._ik_solver.getJointNamesInChain(
-            self._urdf_string)
+        self.joint_names = self._ik_solver.getJointNamesInChain()
         self.link_names = self._ik_solver.getLinkNamesInChain()
+        # Serializes the calls of threads sharing this instance
+        self._lock = threading.Lock()
 
     def get_ik(self, qinit,
                x, y, z,
@@ -71,23 +80,72 @@ class IK(object):
         if len(qinit) != self.number_of_joints:
             raise Exception("qinit has length %i and it should have length %i" % (
                 len(qinit), self.number_of_joints))
-        solution = self._ik_solver.CartToJnt(qinit,
-                                             x, y, z,
-                                             rx, ry, rz, rw,
-                                             bx, by, bz,
-                                             brx, bry, brz)
+        with self._lock:
+            solution = self._ik_solver.CartToJnt(qinit,
+                                                 x, y, z,
+                                                 rx, ry, rz, rw,
+                                                 bx, by, bz,
+                                                 brx, bry, brz)
         if solution:
             return solution
         else:
             return None
 
+    def get_ik_batch(self, qinit, poses,
+                     bounds=(1e-5, 1e-5, 1e-5, 1e-3, 1e-3, 1e-3)):
+        """
+        Do many IK calls at once. The poses are spread over C++ threads on
+        all cores, and the GIL is released while they are solved. NumPy
+        arrays that are already C contiguous float64 are passed without a
+        copy.
+
+        :param numpy.ndarray qinit: Seeds, shape (N, number_of_joints), or
+            a single seed of shape (number_of_joints,) for every pose.
+        :param numpy.ndarray poses: Poses in base_frame, shape (N, 7), each
+            row x, y, z, rx, ry, rz, rw.
+        :param tuple of float bounds: Allowed bounds bx, by, bz, brx, bry,
+            brz, as in get_ik.
+
+        :return: joint values of shape (N, number_of_joints), NaN in the
+            rows without a solution, and the status of every row, which is
+            negative when no solution was found.
+        :rtype: tuple of numpy.ndarray.
+        """
+        import numpy as np
+
+        poses = np.ascontiguousarray(poses, dtype=np.float64)
+        qinit = np.ascontiguousarray(qinit, dtype=np.float64)
+        if poses.ndim != 2 or poses.shape[1] != 7:
+            raise Exception("poses has shape %s and it should have shape (N, 7)" % (
+                poses.shape,))
+        num_poses = poses.shape[0]
+        if qinit.shape != (self.number_of_joints,) and \
+                qinit.shape != (num_poses, self.number_of_joints):
+            raise Exception("qinit has shape %s and it should have shape (%i,) or (%i, %i)" % (
+                qinit.shape, self.number_of_joints,
+                num_poses, self.number_of_joints))
+        if len(bounds) != 6:
+            raise Exception("bounds has length %i and it should have length 6" % len(bounds))
+
+        solutions = np.empty((num_poses, self.number_of_joints), dtype=np.float64)
+        status = np.full(num_poses, -3, dtype=np.int32)
+        if num_poses == 0:
+            return solutions, status
+
+        with self._lock:
+            self._ik_solver.CartToJntBatch(qinit, poses, solutions, status,
+                                           *[float(b) for b in bounds])
+        solutions[status < 0] = np.nan
+        return solutions, status
+
     def get_joint_limits(self):
         """
         Return lower bound limits and upper bound limits for all the joints
         in the order of the joint names.
         """
-        lb = self._ik_solver.getLowerBoundLimits()
-        ub = self._ik_solver.getUpperBoundLimits()
+        with self._lock:
+            lb = self._ik_solver.getLowerBoundLimits()
+            ub = self._ik_solver.getUpperBoundLimits()
         return lb, ub
 
     def set_joint_limits(self, lower_bounds, upper_bounds):
@@ -108,4 +166,5 @@ class IK(object):
             raise Exception("upper_bounds array size mismatch, it's size %i, should be %i" % (
                 len(upper_bounds),
                 self.number_of_joints))
-        self._ik_solver.setKDLLimits(lower_bounds, upper_bounds)
+        with self._lock:
+            self._ik_solver.setKDLLimits(lower_bounds, upper_bounds)
@@ -6,9 +6,9 @@
  %{
  /* Includes the header in the wrapper code */
  #include <trac_ik/trac_ik.hpp>
- #include <urdf/model.h>
+ #include <trac_ik/chain_builder.hpp>
  #include <ros/ros.h>
- #include <kdl_parser/kdl_parser.hpp>
+ #include <cstring>
  #include <limits>
  #include <tf_conversions/tf_kdl.h>
  %}
@@ -17,6 +17,8 @@
  // NotImplementedError: Wrong number or type of arguments for overloaded function
  %include <std_string.i>
  %include <std_vector.i>
+ // For setSeed(uint64_t)
+ %include <stdint.i>
 
 // From http://stackoverflow.com/a/8752983
 // Instantiate templates used by example
@@ -30,23 +32,109 @@ namespace std {
 // USEFUL DOCS: http://www.swig.org/Doc1.3/SWIG.html
 
 
+// Contiguous buffers (NumPy arrays, array.array...) are passed to the batch
+// methods below without a copy, through the Python buffer protocol.  The
+// view is held until the call returns.  The default arguments of those
+// methods make SWIG dispatch between overloads, so every buffer typemap
+// needs a typecheck as well; the in typemaps then check the item type.
+%typemap(in) (const double* IN_ARRAY, size_t IN_SIZE) (Py_buffer view, int got_view = 0) {
+  if (PyObject_GetBuffer($input, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+    SWIG_fail;
+  got_view = 1;
+  if (view.itemsize != sizeof(double) || !view.format || view.format[strlen(view.format) - 1] != 'd')
+    SWIG_exception_fail(SWIG_TypeError, "expected a C contiguous float64 array");
+  $1 = (double*) view.buf;
+  $2 = view.len / sizeof(double);
+}
+%typemap(freearg) (const double* IN_ARRAY, size_t IN_SIZE) {
+  if (got_view$argnum)
+    PyBuffer_Release(&view$argnum);
+}
+%typecheck(SWIG_TYPECHECK_DOUBLE_ARRAY) (const double* IN_ARRAY, size_t IN_SIZE) {
+  $1 = PyObject_CheckBuffer($input);
+}
+
+%typemap(in) (double* INPLACE_ARRAY, size_t INPLACE_SIZE) (Py_buffer view, int got_view = 0) {
+  if (PyObject_GetBuffer($input, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | PyBUF_WRITABLE) != 0)
+    SWIG_fail;
+  got_view = 1;
+  if (view.itemsize != sizeof(double) || !view.format || view.format[strlen(view.format) - 1] != 'd')
+    SWIG_exception_fail(SWIG_TypeError, "expected a writable C contiguous float64 array");
+  $1 = (double*) view.buf;
+  $2 = view.len / sizeof(double);
+}
+%typemap(freearg) (double* INPLACE_ARRAY, size_t INPLACE_SIZE) {
+  if (got_view$argnum)
+    PyBuffer_Release(&view$argnum);
+}
+%typecheck(SWIG_TYPECHECK_DOUBLE_ARRAY) (double* INPLACE_ARRAY, size_t INPLACE_SIZE) {
+  $1 = PyObject_CheckBuffer($input);
+}
+
+%typemap(in) (int* INPLACE_ARRAY, size_t INPLACE_SIZE) (Py_buffer view, int got_view = 0) {
+  if (PyObject_GetBuffer($input, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | PyBUF_WRITABLE) != 0)
+    SWIG_fail;
+  got_view = 1;
+  if (view.itemsize != sizeof(int) || !view.format || !strchr("il", view.format[strlen(view.format) - 1]))
+    SWIG_exception_fail(SWIG_TypeError, "expected a writable C contiguous int32 array");
+  $1 = (int*) view.buf;
+  $2 = view.len / sizeof(int);
+}
+%typemap(freearg) (int* INPLACE_ARRAY, size_t INPLACE_SIZE) {
+  if (got_view$argnum)
+    PyBuffer_Release(&view$argnum);
+}
+%typecheck(SWIG_TYPECHECK_INT32_ARRAY) (int* INPLACE_ARRAY, size_t INPLACE_SIZE) {
+  $1 = PyObject_CheckBuffer($input);
+}
+
+%apply (const double* IN_ARRAY, size_t IN_SIZE) {
+  (const double* q_init, size_t q_init_size),
+  (const double* poses, size_t poses_size)
+};
+%apply (double* INPLACE_ARRAY, size_t INPLACE_SIZE) {
+  (double* q_out, size_t q_out_size)
+};
+%apply (int* INPLACE_ARRAY, size_t INPLACE_SIZE) {
+  (int* status, size_t status_size)
+};
+
+
 // Ignore original constructors as they are not useful in Python
 // Note the full namespacing
 %ignore TRAC_IK::TRAC_IK::TRAC_IK(const KDL::Chain& _chain, const KDL::JntArray& _q_min, const KDL::JntArray& _q_max, double _maxtime=0.005, double _eps=1e-5, SolveType _type=Speed);
 %ignore TRAC_IK::TRAC_IK::TRAC_IK(const std::string& base_link, const std::string& tip_link, const std::string& URDF_param="/robot_description", double _maxtime=0.005, double _eps=1e-5, SolveType _type=Speed);
 
-// Ignore the runKDL and runNLOPT methods as they fail to be wrapped (and are private anyways)
-%ignore TRAC_IK::runKDL(const KDL::JntArray &q_init, const KDL::Frame &p_in);
-%ignore TRAC_IK::runNLOPT(const KDL::JntArray &q_init, const KDL::Frame &p_in);
-
 // Ignore other methods that we will wrap in a more usable way
 %ignore TRAC_IK::getKDLLimits(KDL::JntArray& lb_, KDL::JntArray& ub_);
 %ignore TRAC_IK::setKDLLimits(KDL::JntArray& lb_, KDL::JntArray& ub_);
 
+// The worker pool is a C++-side tuning knob with no Python equivalent
+%ignore TRAC_IK::setWorkerPool(const std::shared_ptr<WorkerPool>& _pool);
+%ignore TRAC_IK::setSeedDatabase(const std::shared_ptr<const SeedDatabase>& db, unsigned int k);
+%ignore TRAC_IK::setStatsCollector(const std::shared_ptr<SolveStatsCollector>& collector);
+
+// Python picks a portfolio by its size, setPortfolio(kdl_racers, nlopt_racers)
+%ignore TRAC_IK::RacerConfig;
+%ignore TRAC_IK::setPortfolio(const std::vector<RacerConfig>& portfolio);
+%ignore TRAC_IK::getPortfolio() const;
+%ignore TRAC_IK::makePortfolio(unsigned int kdl_racers, unsigned int nlopt_racers);
+
+// Replaced by the buffer based CartToJntBatch below
+%ignore TRAC_IK::CartToJntBatch(const std::vector<KDL::JntArray> &q_init, const std::vector<KDL::Frame> &p_in, std::vector<KDL::JntArray> &q_out, std::vector<int> &rc, const KDL::Twist& bounds = KDL::Twist::Zero());
+
 // All variables will use const reference typemaps
 // This eases dealing with std::vectors
 %naturalvar;
 
+// Only the RestartStrategy enum is needed, for setRestartStrategy
+%ignore TRAC_IK::RestartSampler;
+%include <trac_ik/restart_sampler.hpp>
+
+// Likewise the RacerSelection enum, for setRacerSelection
+%ignore TRAC_IK::RacerScheduler;
+%include <trac_ik/racer_scheduler.hpp>
+
 // Parse the original header file to generate wrappers
 %include <trac_ik/trac_ik.hpp>
 
@@ -59,78 +147,9 @@ namespace std {
     TRAC_IK(const std::string& base_link, const std::string& tip_link, const std::string& urdf_string,
       double timeout, double epsilon, const std::string& solve_type="Speed"){
 
-      urdf::Model robot_model;
-
-      robot_model.initString(urdf_string);
-
-      ROS_DEBUG_STREAM_NAMED("trac_ik","Reading joints and links from URDF");
-
-      KDL::Tree tree;
-
-      if (!kdl_parser::treeFromUrdfModel(robot_model, tree)) {
-        ROS_FATAL("Failed to extract kdl tree from xml robot description");
-      }
-
-
-      KDL::Chain chain;
-
-      if(!tree.getChain(base_link, tip_link, chain)) {
-        ROS_FATAL("Couldn't find chain %s to %s",base_link.c_str(),tip_link.c_str());
-      }
-
-      uint num_joints_;
-      num_joints_ = chain.getNrOfJoints();
-      
-      std::vector<KDL::Segment> chain_segs = chain.segments;
-
-      urdf::JointConstSharedPtr joint;
-
-      std::vector<double> l_bounds, u_bounds;
-
-      KDL::JntArray joint_min, joint_max;
-
-      joint_min.resize(num_joints_);
-      joint_max.resize(num_joints_);
-
-      std::vector<std::string> link_names_;
-      std::vector<std::string> joint_names_;
-
-      uint joint_num=0;
-      for(unsigned int i = 0; i < chain_segs.size(); ++i) {
-
-        link_names_.push_back(chain_segs[i].getName());
-        joint = robot_model.getJoint(chain_segs[i].getJoint().getName());
-        if (joint->type != urdf::Joint::UNKNOWN && joint->type != urdf::Joint::FIXED) {
-          joint_num++;
-          assert(joint_num<=num_joints_);
-          float lower, upper;
-          int hasLimits;
-          joint_names_.push_back(joint->name);
-          if ( joint->type != urdf::Joint::CONTINUOUS ) {
-            if(joint->safety) {
-              lower = std::max(joint->limits->lower, joint->safety->soft_lower_limit);
-              upper = std::min(joint->limits->upper, joint->safety->soft_upper_limit);
-            } else {
-              lower = joint->limits->lower;
-              upper = joint->limits->upper;
-            }
-            hasLimits = 1;
-          }
-          else {
-            hasLimits = 0;
-          }
-          if(hasLimits) {
-            joint_min(joint_num-1)=lower;
-            joint_max(joint_num-1)=upper;
-          }
-          else {
-            joint_min(joint_num-1)=std::numeric_limits<float>::lowest();
-            joint_max(joint_num-1)=std::numeric_limits<float>::max();
-          }
-          ROS_DEBUG_STREAM("IK Using joint "<<chain_segs[i].getName()<<" "<<joint_min(joint_num-1)<<" "<<joint_max(joint_num-1));
-        }
-      }
-
+      // Solvers built from the same URDF share one parsed model
+      TRAC_IK::ChainBuilder builder;
+      builder.build(urdf_string, base_link, tip_link);
 
       TRAC_IK::SolveType solvetype;
 
@@ -146,7 +165,7 @@ namespace std {
           }
           solvetype = TRAC_IK::Speed;
       }
-          TRAC_IK::TRAC_IK* newX = new TRAC_IK::TRAC_IK(chain, joint_min, joint_max, timeout, epsilon, solvetype);
+          TRAC_IK::TRAC_IK* newX = new TRAC_IK::TRAC_IK(builder.getChain(), builder.getLowerLimits(), builder.getUpperLimits(), timeout, epsilon, solvetype);
           return newX;
     }
 
@@ -191,7 +210,12 @@ namespace std {
       bounds.rot.y(boundry);
       bounds.rot.z(boundrz);
 
-      int rc = $self->CartToJnt(in, frame, out, bounds);
+      // The solve only touches this instance, so other Python threads may
+      // run, and solve with their own instances, meanwhile
+      int rc;
+      Py_BEGIN_ALLOW_THREADS
+      rc = $self->CartToJnt(in, frame, out, bounds);
+      Py_END_ALLOW_THREADS
       std::vector<double> vout;
       // If no solution, return empty vector which acts as None
       if (rc == -3)
@@ -203,6 +227,60 @@ namespace std {
       return vout;
     }
 
+    // Solves the N poses in poses (N rows of x y z rx ry rz rw, in the
+    // base frame) with TRAC_IK::CartToJntBatch, over all cores.  q_init
+    // holds one seed or N seeds, q_out receives N rows of joints and
+    // status the return code of every row (< 0 when not solved).  The GIL
+    // is released for the whole solve.  Returns the number of poses
+    // solved, or -1 when the sizes do not match.
+    int CartToJntBatch(const double* q_init, size_t q_init_size,
+     const double* poses, size_t poses_size,
+     double* q_out, size_t q_out_size,
+     int* status, size_t status_size,
+     const double boundx=0.0, const double boundy=0.0, const double boundz=0.0,
+     const double boundrx=0.0, const double boundry=0.0, const double boundrz=0.0)
+    {
+      KDL::Chain chain;
+      $self->getKDLChain(chain);
+      size_t n = chain.getNrOfJoints();
+      size_t num_poses = poses_size / 7;
+
+      if (n == 0 || poses_size % 7 != 0 || (q_init_size != n && q_init_size != num_poses * n) ||
+          q_out_size != num_poses * n || status_size != num_poses)
+        return -1;
+
+      int num_solved;
+      Py_BEGIN_ALLOW_THREADS
+
+      std::vector<KDL::JntArray> in(q_init_size / n, KDL::JntArray(n)), out;
+      for (size_t i = 0; i < in.size(); i++)
+        for (size_t j = 0; j < n; j++)
+          in[i](j) = q_init[i * n + j];
+
+      std::vector<KDL::Frame> frames(num_poses);
+      for (size_t i = 0; i < num_poses; i++)
+      {
+        const double* pose = poses + i * 7;
+        frames[i] = KDL::Frame(KDL::Rotation::Quaternion(pose[3], pose[4], pose[5], pose[6]),
+                               KDL::Vector(pose[0], pose[1], pose[2]));
+      }
+
+      KDL::Twist bounds(KDL::Vector(boundx, boundy, boundz), KDL::Vector(boundrx, boundry, boundrz));
+
+      std::vector<int> rc;
+      num_solved = $self->CartToJntBatch(in, frames, out, rc, bounds);
+
+      for (size_t i = 0; i < rc.size(); i++)
+      {
+        status[i] = rc[i];
+        for (size_t j = 0; j < n; j++)
+          q_out[i * n + j] = rc[i] >= 0 ? out[i](j) : 0.0;
+      }
+
+      Py_END_ALLOW_THREADS
+      return num_solved;
+    }
+
     // Convenience method to check that calls to IK have the correct
     // number of qinit elements
     int getNrOfJointsInChain(){
@@ -211,24 +289,16 @@ namespace std {
       return (int) chain.getNrOfJoints();
     }
 
-    // Convenience method to get the list of joint names as used internally
-    std::vector<std::string> getJointNamesInChain(const std::string& urdf_string){
+    // Convenience method to get the list of joint names as used internally.
+    // The names come from the chain itself, urdf_string is only kept so
+    // that existing callers still work.
+    std::vector<std::string> getJointNamesInChain(const std::string& urdf_string=""){
       KDL::Chain chain;
       $self->getKDLChain(chain);
-      std::vector<KDL::Segment> chain_segs = chain.segments;
-
       std::vector<std::string> joint_names_;
-      std::vector<std::string> link_names_;
-      urdf::JointConstSharedPtr joint;
-
-      urdf::Model robot_model;
-      robot_model.initString(urdf_string);
-
-      for(unsigned int i = 0; i < chain_segs.size(); ++i) {
-        link_names_.push_back(chain_segs[i].getName());
-        joint = robot_model.getJoint(chain_segs[i].getJoint().getName());
-        if (joint->type != urdf::Joint::UNKNOWN && joint->type != urdf::Joint::FIXED) {
-          joint_names_.push_back(joint->name);
+      for(unsigned int i = 0; i < chain.getNrOfSegments(); ++i) {
+        if (chain.getSegment(i).getJoint().getType() != KDL::Joint::None) {
+          joint_names_.push_back(chain.getSegment(i).getJoint().getName());
         }
       }
       return joint_names_;